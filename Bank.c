@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,11 +14,17 @@
 #include <ctype.h>
 #include <setjmp.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include "Functions.h"
 
 #define PORT 8080
 #define SERVER_ADDR "127.0.0.1"
 #define MAX_SIZE 1024
+#define MAX_EVENTS 256
+#define EPOLL_TIMEOUT_MS 1000
 
 // Function to free server database memory
 void freeServerDatabase(ServerDatabase *db) {
@@ -35,23 +42,244 @@ void freeServerDatabase(ServerDatabase *db) {
         if (user->currencyAccounts != NULL) {
             free(user->currencyAccounts);
         }
-    }
-    
-    // Free transaction history
-    Transaction *current = db->transaction_history;
-    while (current != NULL) {
-        Transaction *next = current->next;
-        free(current);
-        current = next;
+        freeTransactionHistory(user);
     }
     
     // Free user array and database
     if (db->userAccountArr != NULL) {
         free(db->userAccountArr);
     }
+    free(db->usernameIndex);
+    destroySlabAllocator(&db->transaction_slab);
+    pthread_rwlock_destroy(&db->lock);
+    pthread_rwlock_destroy(&db->history_lock);
+    free(db->rates);
+    pthread_mutex_destroy(&db->rate_update_lock);
+    for (int i = 0; i < ACCOUNT_LOCK_STRIPES; i++) {
+        pthread_mutex_destroy(&db->account_locks[i].mutex);
+    }
+}
+
+// Raise the open file limit so the event loop can hold thousands of sockets
+static void raiseFileDescriptorLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+            perror("Raising file descriptor limit failed");
+        }
+    }
+}
+
+// Event loop state shared by the reactor and the worker threads
+static int epoll_fd = -1;
+static ClientSession *sessions = NULL;
+static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Worker pool state (pool mode only, worker_count == 0 runs sessions inline)
+static int worker_count = 0;
+static pthread_t *worker_threads = NULL;
+static ClientSession *ready_head = NULL;
+static ClientSession *ready_tail = NULL;
+static bool workers_stopping = false;
+static pthread_mutex_t ready_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+
+// Group commit notifications and the sessions waiting on them
+static int commit_fd = -1;
+static ClientSession *waiting_sessions = NULL;
+static pthread_mutex_t waiting_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Register or re-arm a session, asking for EPOLLOUT only while replies are pending.
+// In pool mode sessions are one-shot so only one worker can own a session at a time.
+static int watchClientSession(int op, ClientSession *session) {
+    struct epoll_event event;
+    event.events = EPOLLIN | (session->out_len > 0 ? EPOLLOUT : 0);
+    if (worker_count > 0) event.events |= EPOLLONESHOT;
+    event.data.ptr = session;
+    return epoll_ctl(epoll_fd, op, session->client_socket, &event);
+}
+
+// Link a freshly accepted session into the active list
+static void trackClientSession(ClientSession *session) {
+    pthread_mutex_lock(&sessions_mutex);
+    session->next = sessions;
+    if (sessions != NULL) sessions->prev = session;
+    sessions = session;
+    pthread_mutex_unlock(&sessions_mutex);
+}
+
+// Unlink a session from the active list, close its socket and free it
+static void closeClientSession(ClientSession *session) {
+    pthread_mutex_lock(&sessions_mutex);
+    if (session->prev != NULL) session->prev->next = session->next;
+    else sessions = session->next;
+    if (session->next != NULL) session->next->prev = session->prev;
+    pthread_mutex_unlock(&sessions_mutex);
+
+    // Closing the socket also drops it from the epoll set
+    if (close(session->client_socket) == EOF)
+        printf("Client Socket Close Failed\n");
+    else
+        printf("Gracefully Closed Client Handler\n");
+
+    freeClientSession(session);
+}
+
+// Replies acknowledging mutations the log failed to store are never sent;
+// dropping the connection keeps the client from taking them as committed
+static void dropUncommittedReplies(ClientSession *session) {
+    if (session->state != SESSION_CLOSED) {
+        printf("Closing client %d: its changes could not be made durable\n", session->client_socket);
+    }
+    session->out_len = 0;
+    session->state = SESSION_CLOSED;
+}
+
+// Park a session whose replies acknowledge a mutation that is not durable yet
+static bool parkClientSession(ClientSession *session) {
+    if (session->commit_sequence <= walDurableSequence()) return false;
+
+    pthread_mutex_lock(&waiting_mutex);
+    // Re-check under the lock so a batch that just committed, or a failure
+    // that releaseCommittedSessions has already handled, is not missed
+    if (session->commit_sequence <= walDurableSequence()) {
+        pthread_mutex_unlock(&waiting_mutex);
+        return false;
+    }
+    if (walCommitFailed()) {
+        pthread_mutex_unlock(&waiting_mutex);
+        dropUncommittedReplies(session);
+        return false;
+    }
+    session->parked = true;
+    session->next_waiting = waiting_sessions;
+    waiting_sessions = session;
+    pthread_mutex_unlock(&waiting_mutex);
+
+    // Pool sessions are already disarmed (one-shot); in the inline loop stop
+    // watching the socket so a parked session is never serviced twice
+    if (worker_count == 0) {
+        struct epoll_event event;
+        event.events = EPOLLONESHOT;
+        event.data.ptr = session;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session->client_socket, &event);
+    }
+    return true;
+}
+
+// Read, run and flush one session after a readiness event, then re-arm or close it
+static void serviceClientSession(ClientSession *session, ServerDatabase *database, unsigned int events) {
+    // Feed readable data through the client state machine
+    bool alive = !(events & EPOLLERR);
+    if (alive && (events & (EPOLLIN | EPOLLHUP))) {
+        // Pipelined clients can queue more frames than the input buffer
+        // holds; keep reading while handling frees or grows a full buffer
+        bool full;
+        do {
+            alive = readClientSession(session);
+            full = session->in_len == session->in_cap;
+            handle_client(session, database);
+        } while (alive && full && session->in_len < session->in_cap &&
+                 session->state != SESSION_CLOSED);
+    }
+
+    // Hold replies until the mutations they acknowledge are durable
+    if (alive && parkClientSession(session)) {
+        return;
+    }
+
+    // Flush queued replies; sessions that finished close once drained
+    int pending = alive ? flushClientSession(session) : -1;
+    if (pending == -1 || (pending == 0 && session->state == SESSION_CLOSED)) {
+        closeClientSession(session);
+    } else if (watchClientSession(EPOLL_CTL_MOD, session) == -1) {
+        perror("Client Session Re-arm Error");
+        closeClientSession(session);
+    }
+}
+
+// Hand a ready session to the worker pool
+static void pushReadySession(ClientSession *session, unsigned int events) {
+    pthread_mutex_lock(&ready_mutex);
+    session->ready_events = events;
+    session->next_ready = NULL;
+    if (ready_tail != NULL) ready_tail->next_ready = session;
+    else ready_head = session;
+    ready_tail = session;
+    pthread_cond_signal(&ready_cond);
+    pthread_mutex_unlock(&ready_mutex);
+}
+
+// Block until a ready session is available; NULL once the pool is stopping.
+// Its events are read here, under the queue lock that guarded their write.
+static ClientSession* popReadySession(unsigned int *events) {
+    pthread_mutex_lock(&ready_mutex);
+    while (ready_head == NULL && !workers_stopping) {
+        pthread_cond_wait(&ready_cond, &ready_mutex);
+    }
+    ClientSession *session = workers_stopping ? NULL : ready_head;
+    if (session != NULL) {
+        ready_head = session->next_ready;
+        if (ready_head == NULL) ready_tail = NULL;
+        *events = session->ready_events;
+    }
+    pthread_mutex_unlock(&ready_mutex);
+    return session;
+}
+
+// After a group commit, resume every parked session whose batch is durable
+static void releaseCommittedSessions(ServerDatabase *database) {
+    unsigned long long commits;
+    if (read(commit_fd, &commits, sizeof(commits)) == -1 && errno != EAGAIN) {
+        perror("Commit notification read failed");
+    }
+
+    // After a log failure the remaining sessions can never be acknowledged,
+    // so they are released too and closed without their replies
+    pthread_mutex_lock(&waiting_mutex);
+    long durable = walDurableSequence();
+    bool failed = walCommitFailed();
+    ClientSession *released = NULL;
+    ClientSession **link = &waiting_sessions;
+    while (*link != NULL) {
+        ClientSession *session = *link;
+        if (session->commit_sequence <= durable || failed) {
+            *link = session->next_waiting;
+            session->next_waiting = released;
+            released = session;
+        } else {
+            link = &session->next_waiting;
+        }
+    }
+    pthread_mutex_unlock(&waiting_mutex);
+
+    while (released != NULL) {
+        ClientSession *session = released;
+        released = session->next_waiting;
+        session->parked = false;
+        if (session->commit_sequence > durable) dropUncommittedReplies(session);
+        if (worker_count > 0) {
+            pushReadySession(session, EPOLLIN | EPOLLOUT);
+        } else {
+            serviceClientSession(session, database, EPOLLIN | EPOLLOUT);
+        }
+    }
+}
+
+// Worker thread: serve ready sessions against the shared database
+static void* client_worker(void *arg) {
+    ServerDatabase *database = arg;
+    ClientSession *session;
+    unsigned int events;
+
+    while ((session = popReadySession(&events)) != NULL) {
+        serviceClientSession(session, database, events);
+    }
+    return NULL;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     // Counter for connected clients
     int numOfClientsConnected = 0;
 
@@ -61,14 +289,41 @@ int main() {
     // Structures for server and client socket addresses
     struct sockaddr_in server_addr, client_addr;
 
-    // Thread for handling server console commands
+    // Threads for handling server console commands and background snapshots
     pthread_t cmd_thread;
+    pthread_t snapshot_thread;
 
     // Length of client address structure
     socklen_t client_addr_len = sizeof(client_addr);
 
-    // Process ID used for forked child processes
-    pid_t pid;
+    // Ready events returned by each epoll_wait
+    struct epoll_event events[MAX_EVENTS];
+
+    // Group commit tuning: records per batch and longest wait for a batch
+    int batch_size = WAL_DEFAULT_BATCH_SIZE;
+    int batch_delay_ms = WAL_DEFAULT_MAX_DELAY_MS;
+
+    // Parse options: -w <workers> serves sessions from a fixed thread pool,
+    // -b <records> and -d <ms> configure group commit batching,
+    // -s <seconds> sets the background snapshot interval (0 disables it),
+    // -a <username> names the user allowed to publish exchange rates
+    int opt;
+    while ((opt = getopt(argc, argv, "w:b:d:s:a:")) != -1) {
+        if (opt == 'w' && atoi(optarg) >= 0) {
+            worker_count = atoi(optarg);
+        } else if (opt == 'b' && atoi(optarg) > 0) {
+            batch_size = atoi(optarg);
+        } else if (opt == 'd' && atoi(optarg) >= 0) {
+            batch_delay_ms = atoi(optarg);
+        } else if (opt == 's' && atoi(optarg) >= 0) {
+            snapshot_interval_sec = atoi(optarg);
+        } else if (opt == 'a') {
+            admin_username = optarg;
+        } else {
+            fprintf(stderr, "Usage: %s [-w workers] [-b batch_records] [-d batch_delay_ms] [-s snapshot_interval_sec] [-a admin_user]\n", argv[0]);
+            return 1;
+        }
+    }
 
     // Allocate and initialize server database in dynamic memory
     ServerDatabase *database = malloc(sizeof(ServerDatabase));
@@ -80,9 +335,15 @@ int main() {
     if (!loadServerDatabaseFromFile(database, "database.txt")) {
         printf("No existing database found. Creating new database.\n");
         // Initialize with default exchange rates
-        initializeExchangeRates(&database->exchange_rates);
+        Coins rates;
+        initializeExchangeRates(&rates);
+        setExchangeRates(database, &rates);
     } else {
         printf("Database loaded successfully with %d users.\n", database->totalUsers);
+        // Replayed updates leave the stored Euro totals and the per-currency
+        // totals behind; compute them afresh
+        revalueAllAccounts(database);
+        rebuildCurrencyTotals(database);
     }
 
     // Register SIGINT handler (e.g., Ctrl+C)
@@ -94,10 +355,14 @@ int main() {
         return 1;
     }
 
-    // Create main server socket (TCP stream)
-    server_socket_main = socket(AF_INET, SOCK_STREAM, 0);
+    // Create main server socket (TCP stream, non-blocking for the event loop)
+    raiseFileDescriptorLimit();
+    server_socket_main = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     socketPerror(server_socket_main);
 
+    int reuse = 1;
+    setsockopt(server_socket_main, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     // Configure server address structure
     server_addr.sin_family = AF_INET;          // IPv4
     server_addr.sin_port = htons(PORT);        // Convert port to network byte order
@@ -116,60 +381,125 @@ int main() {
     listenPerror(server_socket_main);
     printf("Server listening on port %d...\n", PORT);
 
+    // Create the epoll instance and watch the listening socket (data.ptr == NULL)
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd == -1) {
+        perror("Error creating epoll instance");
+        freeServerDatabase(database);
+        free(database);
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event listen_event;
+    listen_event.events = EPOLLIN;
+    listen_event.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket_main, &listen_event) == -1) {
+        perror("Error watching server socket");
+        freeServerDatabase(database);
+        free(database);
+        exit(EXIT_FAILURE);
+    }
+
+    // Group commits wake the event loop through an eventfd so held replies go out
+    commit_fd = eventfd(0, EFD_NONBLOCK);
+    struct epoll_event commit_event;
+    commit_event.events = EPOLLIN;
+    commit_event.data.ptr = &commit_fd;
+    if (commit_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, commit_fd, &commit_event) == -1 ||
+        !startWalCommitter(batch_size, batch_delay_ms, commit_fd)) {
+        perror("Error starting group commit");
+        freeServerDatabase(database);
+        free(database);
+        exit(EXIT_FAILURE);
+    }
+
+    // Start the worker pool when running in pool mode
+    if (worker_count > 0) {
+        worker_threads = malloc(worker_count * sizeof(pthread_t));
+        memoryAllocationCheck(worker_threads);
+        for (int i = 0; i < worker_count; i++) {
+            if (pthread_create(&worker_threads[i], NULL, client_worker, database) != 0) {
+                perror("Worker thread creation failed");
+                exit(EXIT_FAILURE);
+            }
+        }
+        printf("Serving clients with %d worker threads.\n", worker_count);
+    }
+
     // Start command listener thread (for admin/server commands)
-    pthread_create(&cmd_thread, NULL, server_command_listener, (void*)&server_socket_main);
+    pthread_create(&cmd_thread, NULL, server_command_listener, database);
+
+    // Start the background snapshot thread (also serves the "snapshot" command)
+    pthread_create(&snapshot_thread, NULL, snapshot_worker, database);
 
-    // Main server loop: accept incoming client connections
+    // Revalue every account whenever the exchange rates change
+    if (!startRevaluationWorker(database)) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Main server loop: multiplex the listening socket and every client session
     while (server_running) {
-        sleep(1); // Small delay to reduce CPU usage
-        printf("Server keeps listening on port %d...\n", PORT);
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, EPOLL_TIMEOUT_MS);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait Failed");
+            break;
+        }
 
-        // Accept incoming client connection
-        client_socket = accept(server_socket_main, (struct sockaddr*)&client_addr, &client_addr_len);
+        // Released sessions may be serviced and freed on the spot, so they are
+        // resumed only after this batch: a later entry for the same session
+        // (an EPOLLHUP seen while it was parked) must not reach freed memory
+        bool commits_ready = false;
+        for (int i = 0; i < ready; i++) {
+            ClientSession *session = events[i].data.ptr;
 
-        // Handle accept errors or shutdown signals
-        if (client_socket == -1) {
-            if (!server_running) {
-                printf("Client Socket Accept interrupted.\nServer is shutting down...\n");
-                break;
+            if (events[i].data.ptr == &commit_fd) {
+                commits_ready = true;
+                continue;
             }
-            perror("Client Socket Accept Error");
-            continue;
-        } else {
-            numOfClientsConnected++;
-        }
 
-        // Log new client connection
-        printf("Client %d connected: %s:%d\n",
-               numOfClientsConnected,
-               inet_ntoa(client_addr.sin_addr),
-               ntohs(client_addr.sin_port));
-
-        socketPerror(client_socket);
-
-        // Fork a new process to handle the client
-        pid = fork();
-        forkPerror(pid);
-
-        if (pid == 0) {
-            // --- Child Process ---
-            // Close server socket in child (not needed)
-            close(server_socket_main);
-            
-            // Handle client communication
-            handle_client(client_socket, server_socket_main, database);
-
-            // Close client socket in child process
-            if (close(client_socket) == EOF)
-                printf("Child Client Socket Close Failed\n");
-            else
-                printf("Gracefully Closed Client Child Handler\n");
-
-            exit(EXIT_SUCCESS);
-        } else {
-            // --- Parent Process ---
-            // Close client socket in parent to free resources
-            close(client_socket);
+            if (session == NULL) {
+                // Accept every pending connection on the listening socket
+                while ((client_socket = accept4(server_socket_main, (struct sockaddr*)&client_addr,
+                                                &client_addr_len, SOCK_NONBLOCK)) != -1) {
+                    session = createClientSession(client_socket);
+                    if (session == NULL) {
+                        close(client_socket);
+                        continue;
+                    }
+
+                    // Track before arming so a worker never sees an unlinked session
+                    trackClientSession(session);
+                    if (watchClientSession(EPOLL_CTL_ADD, session) == -1) {
+                        perror("Client Session Setup Error");
+                        closeClientSession(session);
+                        continue;
+                    }
+                    numOfClientsConnected++;
+
+                    // Log new client connection
+                    printf("Client %d connected: %s:%d\n",
+                           numOfClientsConnected,
+                           inet_ntoa(client_addr.sin_addr),
+                           ntohs(client_addr.sin_port));
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    if (!server_running) {
+                        printf("Client Socket Accept interrupted.\nServer is shutting down...\n");
+                        break;
+                    }
+                    perror("Client Socket Accept Error");
+                }
+                continue;
+            }
+
+            if (worker_count > 0) {
+                pushReadySession(session, events[i].events);
+            } else if (!session->parked) {
+                serviceClientSession(session, database, events[i].events);
+            }
+        }
+        if (commits_ready) {
+            releaseCommittedSessions(database);
         }
     }
 
@@ -179,6 +509,27 @@ int main() {
 
     printf("\n=== Starting server shutdown cleanup ===\n");
 
+    // Stop the worker pool before touching the database or sessions
+    if (worker_count > 0) {
+        printf("Stopping worker threads...\n");
+        pthread_mutex_lock(&ready_mutex);
+        workers_stopping = true;
+        pthread_cond_broadcast(&ready_cond);
+        pthread_mutex_unlock(&ready_mutex);
+        for (int i = 0; i < worker_count; i++) {
+            pthread_join(worker_threads[i], NULL);
+        }
+        free(worker_threads);
+    }
+
+    // Let a snapshot in progress finish before the final save
+    pthread_join(snapshot_thread, NULL);
+    stopRevaluationWorker();
+
+    // Flush the last group commit batch
+    stopWalCommitter();
+    printWalCommitStats();
+
     // Save database to file before shutting down
     printf("Saving database to file...\n");
     if (saveServerDatabaseToFile(database, "database.txt")) {
@@ -186,6 +537,7 @@ int main() {
     } else {
         printf("Failed to save database.\n");
     }
+    closeWriteAheadLog();
 
     // Cleanup phase after server loop ends
     printf("Closing main server socket...\n");
@@ -199,11 +551,14 @@ int main() {
         perror("pthread_join Failed");
     }
 
-    // Wait for any remaining child processes to finish
-    printf("Waiting for child processes to finish...\n");
-    while (waitpid(-1, NULL, WNOHANG) > 0) {
-        // Continue waiting until no more child processes
+    // Disconnect any clients still attached to the event loop
+    printf("Closing client sessions...\n");
+    waiting_sessions = NULL;
+    while (sessions != NULL) {
+        closeClientSession(sessions);
     }
+    close(commit_fd);
+    close(epoll_fd);
 
     // Free database memory
     printf("Freeing database memory...\n");
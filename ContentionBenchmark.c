@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <setjmp.h>
+#include "Functions.h"
+
+// Hammers one hot balance from several workers with three update schemes:
+// the lock-free compare-and-swap in updateCurrencyBalanceAtomic, a mutex
+// around a plain update, and an fcntl byte-range lock on the account's record.
+// fcntl locks only exclude other processes, so every variant runs its
+// workers as processes sharing the account through an anonymous mapping.
+//
+// Usage: ./contention_bench [max_workers] [updates_per_worker]
+
+#define DEFAULT_MAX_WORKERS 8
+#define DEFAULT_UPDATES 200000
+
+typedef enum {
+    CONTENTION_LOCK_FREE,
+    CONTENTION_MUTEX,
+    CONTENTION_FCNTL
+} ContentionMode;
+
+// State shared by the parent and every worker process
+typedef struct {
+    CurrencyAccount account;
+    pthread_mutex_t mutex;
+    int start;
+    long failures;
+} SharedAccount;
+
+static const char *modeName(ContentionMode mode) {
+    switch (mode) {
+        case CONTENTION_LOCK_FREE: return "lock-free";
+        case CONTENTION_MUTEX: return "mutex";
+        default: return "fcntl";
+    }
+}
+
+// The previous locked update path: check and write under the caller's lock
+static int lockedUpdate(CurrencyAccount *account, int currency_index, Money amount) {
+    Money updated;
+    if (__builtin_add_overflow(account->coins[currency_index], amount, &updated) || updated < 0) {
+        return 0;
+    }
+    account->coins[currency_index] = updated;
+    return 1;
+}
+
+// Alternate deposits and withdrawals of one cent so the balance never
+// legitimately runs out and the final balance must equal the initial one
+static void runWorker(SharedAccount *shared, ContentionMode mode, int lock_fd, int updates) {
+    while (!__atomic_load_n(&shared->start, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    long failures = 0;
+    for (int i = 0; i < updates; i++) {
+        Money amount = (i & 1) ? -1 : 1;
+        int success;
+        switch (mode) {
+            case CONTENTION_LOCK_FREE:
+                success = updateCurrencyBalanceAtomic(&shared->account, CURRENCY_EURO, amount, NULL);
+                break;
+            case CONTENTION_MUTEX:
+                pthread_mutex_lock(&shared->mutex);
+                success = lockedUpdate(&shared->account, CURRENCY_EURO, amount);
+                pthread_mutex_unlock(&shared->mutex);
+                break;
+            default:
+                lock_file_range(lock_fd, 0, sizeof(CurrencyAccount), true);
+                success = lockedUpdate(&shared->account, CURRENCY_EURO, amount);
+                lock_file_range(lock_fd, 0, sizeof(CurrencyAccount), false);
+                break;
+        }
+        if (!success) failures++;
+    }
+    __atomic_add_fetch(&shared->failures, failures, __ATOMIC_RELAXED);
+}
+
+static int runBenchmark(SharedAccount *shared, ContentionMode mode, int lock_fd, int workers, int updates) {
+    memset(&shared->account, 0, sizeof(CurrencyAccount));
+    shared->start = 0;
+    shared->failures = 0;
+
+    for (int w = 0; w < workers; w++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork failed");
+            return 0;
+        }
+        if (pid == 0) {
+            runWorker(shared, mode, lock_fd, updates);
+            _exit(0);
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    __atomic_store_n(&shared->start, 1, __ATOMIC_RELEASE);
+    while (wait(NULL) > 0) {
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double total = (double)workers * updates;
+    printf("%-10s %8d %14.2f %12.1f %10ld %12s\n",
+           modeName(mode), workers, total / seconds / 1e6, seconds * 1e9 / total,
+           shared->failures, shared->account.coins[CURRENCY_EURO] == 0 ? "ok" : "CORRUPT");
+    fflush(stdout);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int max_workers = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_WORKERS;
+    int updates = argc > 2 ? atoi(argv[2]) : DEFAULT_UPDATES;
+    if (max_workers < 1 || updates < 1) {
+        fprintf(stderr, "Usage: %s [max_workers] [updates_per_worker]\n", argv[0]);
+        return 1;
+    }
+
+    SharedAccount *shared = mmap(NULL, sizeof(SharedAccount), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("Failed to map shared account");
+        return 1;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shared->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    // Scratch file whose first record stands in for the account on disk
+    char lock_path[] = "/tmp/contention_benchXXXXXX";
+    int lock_fd = mkstemp(lock_path);
+    if (lock_fd == -1) {
+        perror("Failed to create lock file");
+        return 1;
+    }
+    unlink(lock_path);
+
+    printf("One hot balance, %d updates per worker (%ld CPUs online)\n",
+           updates, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-10s %8s %14s %12s %10s %12s\n",
+           "mode", "workers", "Mupdates/s", "ns/update", "failures", "balance");
+    fflush(stdout);
+
+    ContentionMode modes[] = { CONTENTION_LOCK_FREE, CONTENTION_MUTEX, CONTENTION_FCNTL };
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        for (int workers = 1; workers <= max_workers; workers *= 2) {
+            if (!runBenchmark(shared, modes[m], lock_fd, workers, updates)) return 1;
+        }
+    }
+
+    close(lock_fd);
+    pthread_mutex_destroy(&shared->mutex);
+    munmap(shared, sizeof(SharedAccount));
+    return 0;
+}
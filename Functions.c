@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +9,7 @@
 #include <netinet/in.h>
 #include <sys/wait.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/select.h>
 #include <signal.h>
 #include <ctype.h>
@@ -15,6 +17,7 @@
 #include <fcntl.h>
 #include <time.h>
 #include <errno.h>
+#include <stddef.h>
 #include "Functions.h"
 
 #define MAX_SIZE 1024
@@ -24,6 +27,7 @@ jmp_buf env;
 volatile bool server_running = true;
 pthread_mutex_t server_state_mutex = PTHREAD_MUTEX_INITIALIZER;
 int server_socket_main;
+const char *admin_username = NULL;
 
 // File descriptor for database lock
 static int db_lock_fd = -1;
@@ -72,36 +76,156 @@ int unlock_database_file() {
     return 0;
 }
 
+// ============================================================
+// Striped Account Locks
+// ============================================================
+
+static LockStripe* accountStripe(ServerDatabase *db, int client_id, int account_id) {
+    // Mix both ids so one user's accounts spread across the table
+    uint32_t hash = (uint32_t)client_id * 2654435761u ^ (uint32_t)account_id * 2246822519u;
+    hash ^= hash >> 15;
+    return &db->account_locks[hash & (ACCOUNT_LOCK_STRIPES - 1)];
+}
+
+// Every balance change holds its account's stripe until the change is in
+// the write-ahead log, so the log orders each account's changes the way
+// they happened. Changes only run under the shared database lock, so the
+// account cannot move meanwhile.
+static void lockStripe(LockStripe *stripe) {
+    pthread_mutex_lock(&stripe->mutex);
+    // Mark the write in progress before any balance changes
+    __atomic_store_n(&stripe->sequence, stripe->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void unlockStripe(LockStripe *stripe) {
+    __atomic_store_n(&stripe->sequence, stripe->sequence + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&stripe->mutex);
+}
+
+void lockAccount(ServerDatabase *db, int client_id, int account_id) {
+    lockStripe(accountStripe(db, client_id, account_id));
+}
+
+void unlockAccount(ServerDatabase *db, int client_id, int account_id) {
+    unlockStripe(accountStripe(db, client_id, account_id));
+}
+
+// Two accounts are always locked in stripe table order, so operations on the
+// same pair running in opposite directions cannot deadlock; accounts that
+// hash to one stripe lock it once
+void lockAccountPair(ServerDatabase *db, int client_a, int account_a, int client_b, int account_b) {
+    LockStripe *a = accountStripe(db, client_a, account_a);
+    LockStripe *b = accountStripe(db, client_b, account_b);
+    if (a == b) {
+        lockStripe(a);
+    } else if (a < b) {
+        lockStripe(a);
+        lockStripe(b);
+    } else {
+        lockStripe(b);
+        lockStripe(a);
+    }
+}
+
+void unlockAccountPair(ServerDatabase *db, int client_a, int account_a, int client_b, int account_b) {
+    LockStripe *a = accountStripe(db, client_a, account_a);
+    LockStripe *b = accountStripe(db, client_b, account_b);
+    unlockStripe(a);
+    if (b != a) unlockStripe(b);
+}
+
+// Mark an account's stripe in a set taken by lockStripeSet
+static void addStripeToSet(ServerDatabase *db, bool *set, int client_id, int account_id) {
+    set[accountStripe(db, client_id, account_id) - db->account_locks] = true;
+}
+
+// Lock every stripe in the set in table order, as lockAccountPair does, so
+// sets that overlap cannot deadlock
+static void lockStripeSet(ServerDatabase *db, const bool *set) {
+    for (int i = 0; i < ACCOUNT_LOCK_STRIPES; i++) {
+        if (set[i]) lockStripe(&db->account_locks[i]);
+    }
+}
+
+static void unlockStripeSet(ServerDatabase *db, const bool *set) {
+    for (int i = 0; i < ACCOUNT_LOCK_STRIPES; i++) {
+        if (set[i]) unlockStripe(&db->account_locks[i]);
+    }
+}
+
+void readAccount(ServerDatabase *db, int client_id, const CurrencyAccount *account, CurrencyAccount *copy) {
+    // Seqlock read: copy the balances and retry if a stripe holder was
+    // active meanwhile, so views never block each other or the writers
+    LockStripe *stripe = accountStripe(db, client_id, account->account_id);
+    for (int attempt = 0; ; attempt++) {
+        unsigned before = __atomic_load_n(&stripe->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            if (attempt > 64) sched_yield();
+            continue;
+        }
+        copy->account_id = account->account_id;
+        copy->is_shared = account->is_shared;
+        for (int c = 0; c < CURRENCY_COUNT; c++) {
+            copy->coins[c] = __atomic_load_n(&account->coins[c], __ATOMIC_RELAXED);
+        }
+        copy->total_balance = __atomic_load_n(&account->total_balance, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&stripe->sequence, __ATOMIC_RELAXED) == before) break;
+    }
+}
+
 // ============================================================
 // Database Persistence Functions
 // ============================================================
 
 void initializeExchangeRates(Coins *rates) {
-    rates->Euro = 1.00;
-    rates->Dollar = 1.08;
-    rates->Franc = 6.55;
-    rates->Peso = 166.38;
-    rates->Rupee = 89.98;
-    rates->Pound = 0.85;
-    rates->Yen = 158.83;
-    rates->Drachmas = 340.75;
+    rates->rate[CURRENCY_EURO] = 1.00;
+    rates->rate[CURRENCY_DOLLAR] = 1.08;
+    rates->rate[CURRENCY_FRANC] = 6.55;
+    rates->rate[CURRENCY_PESO] = 166.38;
+    rates->rate[CURRENCY_RUPEE] = 89.98;
+    rates->rate[CURRENCY_POUND] = 0.85;
+    rates->rate[CURRENCY_YEN] = 158.83;
+    rates->rate[CURRENCY_DRACHMAS] = 340.75;
 }
 
 int saveServerDatabaseToFile(ServerDatabase *db, const char *filename) {
+    if (!writeDatabaseSnapshot(db, filename)) {
+        return 0;
+    }
+    
+    // Everything up to wal_sequence is now in the snapshot
+    discardRotatedWriteAheadLog();
+    truncateWriteAheadLog();
+    return 1;
+}
+
+int writeDatabaseSnapshot(ServerDatabase *db, const char *filename) {
     if (lock_database_file() == -1) {
         return 0;
     }
     
-    FILE *file = fopen(filename, "wb");
+    // Write the snapshot beside the live file and rename it into place,
+    // so a crash mid-save never leaves a half-written database behind
+    char temp_filename[MAX_SIZE];
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename);
+    
+    FILE *file = fopen(temp_filename, "wb");
     if (!file) {
         unlock_database_file();
         return 0;
     }
     
-    // Save basic database info
+    // Save versioned header and basic database info
+    int magic = DB_FILE_MAGIC;
+    int version = DB_FILE_VERSION;
+    fwrite(&magic, sizeof(int), 1, file);
+    fwrite(&version, sizeof(int), 1, file);
+    fwrite(&db->wal_sequence, sizeof(long), 1, file);
     fwrite(&db->totalUsers, sizeof(int), 1, file);
     fwrite(&db->userid, sizeof(int), 1, file);
-    fwrite(&db->exchange_rates, sizeof(Coins), 1, file);
+    fwrite(&db->rates->rates, sizeof(Coins), 1, file);
     
     // Save each user
     for (int i = 0; i < db->totalUsers; i++) {
@@ -128,11 +252,45 @@ int saveServerDatabaseToFile(ServerDatabase *db, const char *filename) {
         }
     }
     
+    // Make the snapshot durable before it replaces the old one
+    int success = fflush(file) == 0 && fsync(fileno(file)) == 0;
     fclose(file);
+    if (!success || rename(temp_filename, filename) == -1) {
+        perror("Error writing database snapshot");
+        unlink(temp_filename);
+        unlock_database_file();
+        return 0;
+    }
+    
     unlock_database_file();
     return 1;
 }
 
+// Snapshots before version 3 stored balances as doubles
+typedef struct {
+    int account_id;
+    int is_shared;
+    double coins[CURRENCY_COUNT];
+    double total_balance;
+} LegacyCurrencyAccount;
+
+static void readLegacyCurrencyAccount(FILE *file, CurrencyAccount *account) {
+    LegacyCurrencyAccount legacy;
+    memset(account, 0, sizeof(CurrencyAccount));
+    if (fread(&legacy, sizeof(LegacyCurrencyAccount), 1, file) != 1) return;
+    
+    // Balances become minor units; negative or unconvertible ones load as
+    // zero. The Euro total is left for the startup revaluation.
+    account->account_id = legacy.account_id;
+    account->is_shared = legacy.is_shared;
+    for (int i = 0; i < CURRENCY_COUNT; i++) {
+        Money balance = 0;
+        if (toMinorUnits(i, legacy.coins[i], &balance) && balance > 0) {
+            account->coins[i] = balance;
+        }
+    }
+}
+
 int loadServerDatabaseFromFile(ServerDatabase *db, const char *filename) {
     if (lock_database_file() == -1) {
         return 0;
@@ -141,21 +299,43 @@ int loadServerDatabaseFromFile(ServerDatabase *db, const char *filename) {
     FILE *file = fopen(filename, "rb");
     if (!file) {
         unlock_database_file();
-        return 0;
+        // No snapshot yet, the log alone may still hold the database
+        int replayed = replayWriteAheadLog(db, WAL_ROTATED_FILE);
+        replayed += replayWriteAheadLog(db, WAL_FILE);
+        return replayed > 0;
+    }
+    
+    // Versioned snapshots start with a magic number; older files start with totalUsers
+    int magic = 0, version = 0;
+    db->wal_sequence = 0;
+    if (fread(&magic, sizeof(int), 1, file) == 1 && magic == DB_FILE_MAGIC) {
+        fread(&version, sizeof(int), 1, file);
+        if (version != DB_FILE_VERSION && version != 2) {
+            fprintf(stderr, "Unsupported database version %d\n", version);
+            fclose(file);
+            unlock_database_file();
+            return 0;
+        }
+        fread(&db->wal_sequence, sizeof(long), 1, file);
+    } else {
+        rewind(file);
     }
     
     // Load basic database info
     fread(&db->totalUsers, sizeof(int), 1, file);
     fread(&db->userid, sizeof(int), 1, file);
-    fread(&db->exchange_rates, sizeof(Coins), 1, file);
+    Coins rates;
+    fread(&rates, sizeof(Coins), 1, file);
+    setExchangeRates(db, &rates);
     
     // Allocate memory for users
-    db->userAccountArr = malloc(db->totalUsers * sizeof(UserAccount));
-    if (!db->userAccountArr) {
+    UserAccount *users = realloc(db->userAccountArr, (db->totalUsers + 1) * sizeof(UserAccount));
+    if (!users) {
         fclose(file);
         unlock_database_file();
         return 0;
     }
+    db->userAccountArr = users;
     
     // Load each user
     for (int i = 0; i < db->totalUsers; i++) {
@@ -182,857 +362,2723 @@ int loadServerDatabaseFromFile(ServerDatabase *db, const char *filename) {
         if (user->currencyAccountNum > 0) {
             user->currencyAccounts = malloc(user->currencyAccountNum * sizeof(CurrencyAccount));
             for (int j = 0; j < user->currencyAccountNum; j++) {
-                fread(&user->currencyAccounts[j], sizeof(CurrencyAccount), 1, file);
+                if (version == DB_FILE_VERSION) {
+                    fread(&user->currencyAccounts[j], sizeof(CurrencyAccount), 1, file);
+                } else {
+                    readLegacyCurrencyAccount(file, &user->currencyAccounts[j]);
+                }
             }
         } else {
             user->currencyAccounts = NULL;
         }
+        
+        // Transaction history is rebuilt from the log tail below
+        user->history = NULL;
+        user->historyCount = 0;
+        user->historyCapacity = 0;
     }
     
-    // Initialize transaction history (empty for now)
-    db->transaction_history = NULL;
-    
     fclose(file);
     unlock_database_file();
+    
+    // Index every loaded username before replay starts adding users
+    buildUsernameIndex(db, db->totalUsers);
+    
+    // Re-apply every mutation logged after the snapshot was taken,
+    // starting with a segment left behind by an unfinished snapshot
+    replayWriteAheadLog(db, WAL_ROTATED_FILE);
+    replayWriteAheadLog(db, WAL_FILE);
     return 1;
 }
 
 // ============================================================
-// Currency Exchange Functions
+// Write-Ahead Log
 // ============================================================
 
-int getCurrencyIndex(const char *currency_name) {
-    if (strcmp(currency_name, "Euro") == 0) return 0;
-    if (strcmp(currency_name, "Dollar") == 0) return 1;
-    if (strcmp(currency_name, "Pound") == 0) return 2;
-    if (strcmp(currency_name, "Yen") == 0) return 3;
-    if (strcmp(currency_name, "Rupee") == 0) return 4;
-    if (strcmp(currency_name, "Peso") == 0) return 5;
-    if (strcmp(currency_name, "Franc") == 0) return 6;
-    if (strcmp(currency_name, "Drachmas") == 0) return 7;
-    return -1;
-}
-
-const char* getCurrencyName(int index) {
-    switch(index) {
-        case 0: return "Euro";
-        case 1: return "Dollar";
-        case 2: return "Pound";
-        case 3: return "Yen";
-        case 4: return "Rupee";
-        case 5: return "Peso";
-        case 6: return "Franc";
-        case 7: return "Drachmas";
-        default: return "Unknown";
-    }
-}
-
-void applyExchangeRates(Coins *rates, double amount, const char *from_currency, 
-                       double *result, const char *to_currency) {
-    // Convert to Euros first
-    double in_euros;
-    if (strcmp(from_currency, "Euro") == 0) in_euros = amount;
-    else if (strcmp(from_currency, "Dollar") == 0) in_euros = amount / rates->Dollar;
-    else if (strcmp(from_currency, "Pound") == 0) in_euros = amount / rates->Pound;
-    else if (strcmp(from_currency, "Yen") == 0) in_euros = amount / rates->Yen;
-    else if (strcmp(from_currency, "Rupee") == 0) in_euros = amount / rates->Rupee;
-    else if (strcmp(from_currency, "Peso") == 0) in_euros = amount / rates->Peso;
-    else if (strcmp(from_currency, "Franc") == 0) in_euros = amount / rates->Franc;
-    else if (strcmp(from_currency, "Drachmas") == 0) in_euros = amount / rates->Drachmas;
-    else in_euros = amount;
-    
-    // Convert from Euros to target currency
-    if (strcmp(to_currency, "Euro") == 0) *result = in_euros;
-    else if (strcmp(to_currency, "Dollar") == 0) *result = in_euros * rates->Dollar;
-    else if (strcmp(to_currency, "Pound") == 0) *result = in_euros * rates->Pound;
-    else if (strcmp(to_currency, "Yen") == 0) *result = in_euros * rates->Yen;
-    else if (strcmp(to_currency, "Rupee") == 0) *result = in_euros * rates->Rupee;
-    else if (strcmp(to_currency, "Peso") == 0) *result = in_euros * rates->Peso;
-    else if (strcmp(to_currency, "Franc") == 0) *result = in_euros * rates->Franc;
-    else if (strcmp(to_currency, "Drachmas") == 0) *result = in_euros * rates->Drachmas;
-    else *result = in_euros;
-}
-
-double getCurrencyBalance(CurrencyAccount *account, int currency_index) {
-    switch(currency_index) {
-        case 0: return account->coins.Euro;
-        case 1: return account->coins.Dollar;
-        case 2: return account->coins.Pound;
-        case 3: return account->coins.Yen;
-        case 4: return account->coins.Rupee;
-        case 5: return account->coins.Peso;
-        case 6: return account->coins.Franc;
-        case 7: return account->coins.Drachmas;
-        default: return 0.0;
-    }
-}
-
-int updateCurrencyBalance(CurrencyAccount *account, int currency_index, double amount) {
-    // For shared accounts, we need to lock the database
-    if (account->is_shared) {
-        if (lock_database_file() == -1) {
-            return 0;
-        }
-    }
-    
-    int success = 1;
-    switch(currency_index) {
-        case 0: 
-            if (account->coins.Euro + amount >= 0) account->coins.Euro += amount;
-            else success = 0;
-            break;
-        case 1: 
-            if (account->coins.Dollar + amount >= 0) account->coins.Dollar += amount;
-            else success = 0;
-            break;
-        case 2: 
-            if (account->coins.Pound + amount >= 0) account->coins.Pound += amount;
-            else success = 0;
-            break;
-        case 3: 
-            if (account->coins.Yen + amount >= 0) account->coins.Yen += amount;
-            else success = 0;
-            break;
-        case 4: 
-            if (account->coins.Rupee + amount >= 0) account->coins.Rupee += amount;
-            else success = 0;
-            break;
-        case 5: 
-            if (account->coins.Peso + amount >= 0) account->coins.Peso += amount;
-            else success = 0;
-            break;
-        case 6: 
-            if (account->coins.Franc + amount >= 0) account->coins.Franc += amount;
-            else success = 0;
-            break;
-        case 7: 
-            if (account->coins.Drachmas + amount >= 0) account->coins.Drachmas += amount;
-            else success = 0;
-            break;
-        default: success = 0;
-    }
-    
-    // Update total balance in Euros
-    if (success) {
-        account->total_balance = 0;
-        account->total_balance += account->coins.Euro;
-        account->total_balance += account->coins.Dollar / account->coins.Dollar;
-    }
-    
-    if (account->is_shared) {
-        unlock_database_file();
+// Append-only log descriptor, opened on first use
+static int wal_fd = -1;
+
+// Group commit state: records are buffered here and made durable in
+// batches by the committer thread, one write + fdatasync per batch
+static pthread_mutex_t wal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wal_io_mutex = PTHREAD_MUTEX_INITIALIZER;  // Held while writing or rotating the file
+static pthread_cond_t wal_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t wal_committer;
+static bool wal_committer_running = false;
+static bool wal_committer_stopping = false;
+static char *wal_buffer = NULL;
+static size_t wal_buffer_len = 0;
+static size_t wal_buffer_cap = 0;
+static int wal_pending_records = 0;
+static long wal_buffered_sequence = 0;
+static long wal_durable_sequence = 0;
+static bool wal_failed = false;     // A record could not be stored; nothing later is durable
+static int wal_batch_size = WAL_DEFAULT_BATCH_SIZE;
+static int wal_max_delay_ms = WAL_DEFAULT_MAX_DELAY_MS;
+static int wal_notify_fd = -1;
+
+// Last sequence appended by the calling thread, so a session waits only
+// for its own mutations to become durable
+static __thread long thread_appended_sequence = 0;
+
+// Achieved batch sizes, bucketed by powers of two (1, 2-3, 4-7, ...)
+static long wal_stat_batches = 0;
+static long wal_stat_records = 0;
+static int wal_stat_largest = 0;
+static long wal_stat_histogram[WAL_STAT_BUCKETS];
+
+_Static_assert(sizeof(WalRecord) == offsetof(WalRecord, checksum) + sizeof(unsigned int),
+               "the checksum must be the last bytes of a record");
+
+static unsigned int walChecksumBytes(const WalRecord *record, size_t len) {
+    // FNV-1a over the first len bytes of the record
+    const unsigned char *bytes = (const unsigned char *)record;
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
     }
-    
-    return success;
+    return hash;
 }
 
-// ============================================================
-// Transaction History Functions
-// ============================================================
-
-void addTransaction(ServerDatabase *db, int client_id, int account_id, 
-                   const char *type, const char *from_currency, const char *to_currency,
-                   double amount_from, double amount_to, double exchange_rate) {
-    Transaction *new_transaction = malloc(sizeof(Transaction));
-    static int transaction_id_counter = 1;
-    
-    new_transaction->transaction_id = transaction_id_counter++;
-    new_transaction->client_id = client_id;
-    new_transaction->account_id = account_id;
-    strcpy(new_transaction->transaction_type, type);
-    strcpy(new_transaction->currency_from, from_currency);
-    strcpy(new_transaction->currency_to, to_currency);
-    new_transaction->amount_from = amount_from;
-    new_transaction->amount_to = amount_to;
-    new_transaction->exchange_rate = exchange_rate;
-    new_transaction->timestamp = time(NULL);
-    new_transaction->next = db->transaction_history;
-    
-    db->transaction_history = new_transaction;
+static unsigned int walChecksum(const WalRecord *record) {
+    return walChecksumBytes(record, offsetof(WalRecord, checksum));
 }
 
-void printTransactionHistory(int client_socket, ServerDatabase *db, int client_id) {
-    Transaction *current = db->transaction_history;
-    int count = 0;
-    char buffer[MAX_SIZE];
-    
-    while (current != NULL) {
-        if (current->client_id == client_id) {
-            count++;
-            struct tm *timeinfo = localtime(&current->timestamp);
-            strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
-            
-            printf("Transaction %d: %s - %s %lf to %s %lf (Rate: %lf) at %s\n",
-                   current->transaction_id, current->transaction_type,
-                   current->currency_from, current->amount_from,
-                   current->currency_to, current->amount_to,
-                   current->exchange_rate, buffer);
-        }
-        current = current->next;
-    }
+// Check a record read back from the log. Records of formats 0 and 1 were
+// written with the checksum where format is now and the format after it,
+// outside the checksum; they are moved into the current layout.
+static bool verifyWalRecord(WalRecord *record) {
+    if (record->checksum == walChecksum(record)) return true;
     
-    if (count == 0) {
-        printf("No transactions found for client %d\n", client_id);
+    unsigned int old_checksum = (unsigned int)record->format;
+    int old_format = (int)record->checksum;
+    if ((old_format == 0 || old_format == 1) &&
+        old_checksum == walChecksumBytes(record, offsetof(WalRecord, format))) {
+        record->format = old_format;
+        record->checksum = walChecksum(record);
+        return true;
     }
+    return false;
 }
 
-// ============================================================
-// User Authentication and Management
-// ============================================================
-
-int findUserByUsername(ServerDatabase *db, const char *username) {
-    for (int i = 0; i < db->totalUsers; i++) {
-        if (strcmp(db->userAccountArr[i].username, username) == 0) {
-            return i;
+static int openWriteAheadLog() {
+    if (wal_fd == -1) {
+        wal_fd = open(WAL_FILE, O_CREAT | O_WRONLY | O_APPEND, 0666);
+        if (wal_fd == -1) {
+            perror("Error opening write-ahead log");
+            return 0;
         }
     }
-    return -1;
+    return 1;
 }
 
-int authenticateUser(ServerDatabase *db, const char *username, const char *password) {
-    int user_index = findUserByUsername(db, username);
-    if (user_index == -1) return -1; // User not found
+static void markWalFailed(const char *reason) {
+    // Replay does not look for gaps, so once a record is lost no later one
+    // may reach the log either: it would be applied without its predecessors
+    if (!__atomic_exchange_n(&wal_failed, true, __ATOMIC_ACQ_REL)) {
+        printf("%s; changes from now on will not be acknowledged\n", reason);
+    }
     
-    if (strcmp(db->userAccountArr[user_index].password, password) == 0) {
-        return user_index;
+    // Wake the event loop so sessions waiting on the log are not left parked
+    if (wal_notify_fd != -1) {
+        unsigned long long one = 1;
+        if (write(wal_notify_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            perror("Commit notification failed");
+        }
     }
-    return -1; // Wrong password
 }
 
-int createNewUser(ServerDatabase *db, const char *username, const char *password) {
-    if (findUserByUsername(db, username) != -1) {
-        return 0; // Username already exists
+bool walCommitFailed() {
+    return __atomic_load_n(&wal_failed, __ATOMIC_ACQUIRE);
+}
+
+static int writeWalBytes(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(wal_fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            perror("Error appending to write-ahead log");
+            return 0;
+        }
+        data += written;
+        len -= written;
     }
-    
-    // Reallocate user array
-    UserAccount *temp = realloc(db->userAccountArr, (db->totalUsers + 1) * sizeof(UserAccount));
-    if (!temp) return 0;
-    db->userAccountArr = temp;
-    
-    // Initialize new user
-    UserAccount *new_user = &db->userAccountArr[db->totalUsers];
-    new_user->client_id = db->userid++;
-    new_user->coin_account_id_counter = 1;
-    new_user->currencyAccountNum = 0;
-    new_user->currencyAccounts = NULL;
-    
-    new_user->username = malloc(strlen(username) + 1);
-    strcpy(new_user->username, username);
-    
-    new_user->password = malloc(strlen(password) + 1);
-    strcpy(new_user->password, password);
-    
-    db->totalUsers++;
     return 1;
 }
 
-// ============================================================
-// Currency Exchange Operations
-// ============================================================
+long appendWalRecord(ServerDatabase *db, WalRecord *record) {
+    return appendWalRecords(db, record, 1);
+}
 
-int exchangeCurrency(int client_socket, ServerDatabase *db, UserAccount *user) {
-    int TRUE = 1;
-    int FALSE = 0;
+long appendWalRecords(ServerDatabase *db, WalRecord *records, int count) {
+    if (count <= 0 || !openWriteAheadLog()) return 0;
+    size_t len = (size_t)count * sizeof(WalRecord);
     
-    // Send available accounts count
-    int accounts = user->currencyAccountNum;
-    send(client_socket, &accounts, sizeof(accounts), 0);
+    // Sequences are assigned under wal_mutex so the log is written in
+    // sequence order; balance changes append while their accounts are
+    // still locked, so each account's changes log in the order they applied.
+    // Records appended together are consecutive and reach the disk in one commit.
+    pthread_mutex_lock(&wal_mutex);
+    for (int i = 0; i < count; i++) {
+        records[i].sequence = __atomic_add_fetch(&db->wal_sequence, 1, __ATOMIC_SEQ_CST);
+        records[i].format = WAL_RECORD_FORMAT;
+        records[i].checksum = walChecksum(&records[i]);
+    }
+    long sequence = records[count - 1].sequence;
+    thread_appended_sequence = sequence;
     
-    if (accounts <= 0) {
-        printf("No accounts available for exchange\n");
-        return 0;
+    if (!wal_committer_running) {
+        // No committer: write through immediately
+        pthread_mutex_lock(&wal_io_mutex);
+        int success = !walCommitFailed() && writeWalBytes((const char *)records, len);
+        pthread_mutex_unlock(&wal_io_mutex);
+        if (success) __atomic_store_n(&wal_durable_sequence, sequence, __ATOMIC_RELEASE);
+        else markWalFailed("Write-ahead log append failed");
+        pthread_mutex_unlock(&wal_mutex);
+        return success ? sequence : 0;
     }
     
-    // Receive account selection
-    int account_index;
-    recv(client_socket, &account_index, sizeof(account_index), 0);
+    // Buffer the records for the next batch
+    if (wal_buffer_len + len > wal_buffer_cap) {
+        size_t new_cap = wal_buffer_cap > 0 ? wal_buffer_cap * 2 : sizeof(WalRecord) * 64;
+        while (new_cap < wal_buffer_len + len) {
+            new_cap *= 2;
+        }
+        char *temp = realloc(wal_buffer, new_cap);
+        if (temp == NULL) {
+            perror("Failed to grow write-ahead log buffer");
+            markWalFailed("Write-ahead log record dropped");
+            pthread_mutex_unlock(&wal_mutex);
+            return 0;
+        }
+        wal_buffer = temp;
+        wal_buffer_cap = new_cap;
+    }
+    memcpy(wal_buffer + wal_buffer_len, records, len);
+    wal_buffer_len += len;
+    wal_buffered_sequence = sequence;
     
-    if (account_index < 1 || account_index > accounts) {
-        send(client_socket, &FALSE, sizeof(FALSE), 0);
-        return 0;
+    // Wake the committer when it is idle or the batch is full
+    bool was_idle = wal_pending_records == 0;
+    wal_pending_records += count;
+    if (was_idle || wal_pending_records >= wal_batch_size) {
+        pthread_cond_signal(&wal_cond);
     }
+    pthread_mutex_unlock(&wal_mutex);
+    return sequence;
+}
+
+long walAppendedByThread() {
+    return thread_appended_sequence;
+}
+
+long walDurableSequence() {
+    return __atomic_load_n(&wal_durable_sequence, __ATOMIC_ACQUIRE);
+}
+
+static void* wal_commit_thread(void *arg) {
+    (void)arg;
+    char *batch = NULL;
+    size_t batch_cap = 0;
     
-    CurrencyAccount *account = &user->currencyAccounts[account_index - 1];
+    pthread_mutex_lock(&wal_mutex);
+    while (true) {
+        while (wal_pending_records == 0 && !wal_committer_stopping) {
+            pthread_cond_wait(&wal_cond, &wal_mutex);
+        }
+        if (wal_pending_records == 0) break;
+        
+        // Give concurrent sessions up to wal_max_delay_ms to join this batch
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)wal_max_delay_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (wal_pending_records < wal_batch_size && !wal_committer_stopping) {
+            if (pthread_cond_timedwait(&wal_cond, &wal_mutex, &deadline) == ETIMEDOUT) break;
+        }
+        
+        // Swap the filled buffer out so appends continue during the write
+        char *full = wal_buffer;
+        size_t full_len = wal_buffer_len;
+        size_t full_cap = wal_buffer_cap;
+        int records = wal_pending_records;
+        long sequence = wal_buffered_sequence;
+        wal_buffer = batch;
+        wal_buffer_cap = batch_cap;
+        wal_buffer_len = 0;
+        wal_pending_records = 0;
+        batch = full;
+        batch_cap = full_cap;
+        pthread_mutex_unlock(&wal_mutex);
+        
+        pthread_mutex_lock(&wal_io_mutex);
+        int success = !walCommitFailed() && writeWalBytes(batch, full_len) && fdatasync(wal_fd) == 0;
+        pthread_mutex_unlock(&wal_io_mutex);
+        if (!success) markWalFailed("Write-ahead log commit failed");
+        
+        pthread_mutex_lock(&wal_mutex);
+        if (success) {
+            __atomic_store_n(&wal_durable_sequence, sequence, __ATOMIC_RELEASE);
+        }
+        wal_stat_batches++;
+        wal_stat_records += records;
+        if (records > wal_stat_largest) wal_stat_largest = records;
+        int bucket = 0;
+        while ((records >> (bucket + 1)) > 0 && bucket < WAL_STAT_BUCKETS - 1) bucket++;
+        wal_stat_histogram[bucket]++;
+        
+        // Tell the event loop that acknowledgements can go out (or, after a
+        // failure, must be dropped)
+        if (wal_notify_fd != -1) {
+            unsigned long long one = 1;
+            if (write(wal_notify_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+                perror("Commit notification failed");
+            }
+        }
+    }
+    pthread_mutex_unlock(&wal_mutex);
     
-    // Send current exchange rates to client
-    send(client_socket, &db->exchange_rates, sizeof(Coins), 0);
+    free(batch);
+    return NULL;
+}
+
+int startWalCommitter(int batch_size, int max_delay_ms, int notify_fd) {
+    if (!openWriteAheadLog()) return 0;
     
-    // Receive source currency, target currency, and amount
-    int from_currency, to_currency;
-    double amount;
-    recv(client_socket, &from_currency, sizeof(from_currency), 0);
-    recv(client_socket, &to_currency, sizeof(to_currency), 0);
-    recv(client_socket, &amount, sizeof(amount), 0);
+    wal_batch_size = batch_size > 0 ? batch_size : 1;
+    wal_max_delay_ms = max_delay_ms >= 0 ? max_delay_ms : 0;
+    wal_notify_fd = notify_fd;
+    wal_committer_stopping = false;
     
-    // Check if source currency has sufficient balance
-    double current_balance = getCurrencyBalance(account, from_currency);
-    if (current_balance < amount) {
-        send(client_socket, &FALSE, sizeof(FALSE), 0);
+    if (pthread_create(&wal_committer, NULL, wal_commit_thread, NULL) != 0) {
+        perror("Write-ahead log committer creation failed");
         return 0;
     }
+    wal_committer_running = true;
+    return 1;
+}
+
+void stopWalCommitter() {
+    if (!wal_committer_running) return;
     
-    // Calculate exchange
-    const char *from_curr_name = getCurrencyName(from_currency);
-    const char *to_curr_name = getCurrencyName(to_currency);
-    double exchanged_amount;
-    
-    applyExchangeRates(&db->exchange_rates, amount, from_curr_name, &exchanged_amount, to_curr_name);
+    // The committer flushes whatever is still buffered before exiting
+    pthread_mutex_lock(&wal_mutex);
+    wal_committer_stopping = true;
+    pthread_cond_signal(&wal_cond);
+    pthread_mutex_unlock(&wal_mutex);
+    pthread_join(wal_committer, NULL);
     
-    // Update balances
-    if (updateCurrencyBalance(account, from_currency, -amount) &&
-        updateCurrencyBalance(account, to_currency, exchanged_amount)) {
-        
-        // Add transaction to history
-        addTransaction(db, user->client_id, account->account_id, "EXCHANGE", 
-                      from_curr_name, to_curr_name, amount, exchanged_amount,
-                      exchanged_amount / amount);
-        
-        // Save database
-        saveServerDatabaseToFile(db, DATABASE_FILE);
-        
-        send(client_socket, &TRUE, sizeof(TRUE), 0);
-        send(client_socket, &exchanged_amount, sizeof(exchanged_amount), 0);
-        return 1;
+    pthread_mutex_lock(&wal_mutex);
+    wal_committer_running = false;
+    free(wal_buffer);
+    wal_buffer = NULL;
+    wal_buffer_len = wal_buffer_cap = 0;
+    pthread_mutex_unlock(&wal_mutex);
+}
+
+void printWalCommitStats() {
+    pthread_mutex_lock(&wal_mutex);
+    printf("Group commit: batch size %d, max delay %d ms\n", wal_batch_size, wal_max_delay_ms);
+    printf("  Batches: %ld  Records: %ld  Average: %.2f  Largest: %d\n",
+           wal_stat_batches, wal_stat_records,
+           wal_stat_batches > 0 ? (double)wal_stat_records / wal_stat_batches : 0.0,
+           wal_stat_largest);
+    for (int i = 0; i < WAL_STAT_BUCKETS; i++) {
+        if (wal_stat_histogram[i] == 0) continue;
+        if (i == WAL_STAT_BUCKETS - 1) {
+            printf("  %d+ records: %ld batches\n", 1 << i, wal_stat_histogram[i]);
+        } else {
+            printf("  %d-%d records: %ld batches\n", 1 << i, (2 << i) - 1, wal_stat_histogram[i]);
+        }
     }
-    
-    send(client_socket, &FALSE, sizeof(FALSE), 0);
-    return 0;
+    pthread_mutex_unlock(&wal_mutex);
 }
 
-// ============================================================
-// Updated Server Database Initialization
-// ============================================================
+int truncateWriteAheadLog() {
+    pthread_mutex_lock(&wal_io_mutex);
+    int success;
+    if (wal_fd != -1) {
+        success = ftruncate(wal_fd, 0) == 0;
+    } else {
+        success = truncate(WAL_FILE, 0) == 0 || errno == ENOENT;
+    }
+    pthread_mutex_unlock(&wal_io_mutex);
+    return success;
+}
 
-void initializeServerDatabase(ServerDatabase *db) {
-    db->totalUsers = 0;
-    db->userid = 1;
-    db->userAccountArr = malloc(sizeof(UserAccount));
-    db->transaction_history = NULL;
-    initializeExchangeRates(&db->exchange_rates);
+int rotateWriteAheadLog() {
+    // A segment from a failed snapshot is still needed; keep appending to
+    // the live log and let the next successful snapshot cover both
+    if (access(WAL_ROTATED_FILE, F_OK) == 0) return 0;
+    
+    pthread_mutex_lock(&wal_io_mutex);
+    int success = rename(WAL_FILE, WAL_ROTATED_FILE) == 0;
+    if (success && wal_fd != -1) {
+        close(wal_fd);
+        wal_fd = -1;
+        success = openWriteAheadLog();
+    }
+    pthread_mutex_unlock(&wal_io_mutex);
+    return success;
 }
 
-// ============================================================
-// Safe Token Management Functions - COMPLETELY FIXED
-// ============================================================
+void discardRotatedWriteAheadLog() {
+    if (unlink(WAL_ROTATED_FILE) == -1 && errno != ENOENT) {
+        perror("Error removing rotated write-ahead log");
+    }
+}
 
-void freeTokens(char ***tokens_ptr) {
-    if (tokens_ptr == NULL || *tokens_ptr == NULL) {
-        return;
+void closeWriteAheadLog() {
+    stopWalCommitter();
+    if (wal_fd != -1) {
+        close(wal_fd);
+        wal_fd = -1;
     }
+}
+
+// Records written before balances became fixed-point hold double amounts
+static void upgradeLegacyWalRecord(WalRecord *record) {
+    double amount_from, amount_to;
+    memcpy(&amount_from, &record->amount_from, sizeof(double));
+    memcpy(&amount_to, &record->amount_to, sizeof(double));
     
-    char **tokens = *tokens_ptr;
-    for (int i = 0; tokens[i] != NULL; i++) {
-        free(tokens[i]);
+    int currency_from = record->type == WAL_CREATE_ACCOUNT ? 0 : record->currency_from;
+    if (!toMinorUnits(currency_from, amount_from, &record->amount_from)) record->amount_from = 0;
+    if (!toMinorUnits(record->currency_to, amount_to, &record->amount_to)) record->amount_to = 0;
+    record->format = WAL_RECORD_FORMAT;
+}
+
+// Apply a logged balance change. Every change is logged while its account's
+// stripe is still held, so the log keeps each account's changes in the order
+// they were made and a balance never goes negative on the way.
+static int applyLoggedBalance(CurrencyAccount *account, int currency_index, Money amount) {
+    if (currency_index < 0 || currency_index >= CURRENCY_COUNT) return 0;
+    Money result;
+    if (__builtin_add_overflow(account->coins[currency_index], amount, &result) || result < 0) {
+        return 0;
     }
-    free(tokens);
-    *tokens_ptr = NULL;
+    account->coins[currency_index] = result;
+    return 1;
 }
 
-void tokenizeInput(char *buffer, char ***output) {
-    if (buffer == NULL || output == NULL) {
-        *output = NULL;
-        return;
+// Re-apply one logged mutation through the same helpers the live path uses
+static int applyWalRecord(ServerDatabase *db, const WalRecord *record) {
+    if (record->type == WAL_CREATE_USER) {
+        return createNewUser(db, record->username, record->password);
+    }
+    if (record->type == WAL_SET_RATES) {
+        Coins rates;
+        memcpy(&rates, record->username, sizeof(Coins));
+        if (!validExchangeRates(&rates)) return 0;
+        setExchangeRates(db, &rates);
+        return 1;
     }
     
-    char **tokens = NULL;
-    int token_count = 0;
+    int user_index = findUserByClientId(db, record->client_id);
+    if (user_index == -1) return 0;
+    UserAccount *user = &db->userAccountArr[user_index];
     
-    // Create a copy of the buffer since strtok modifies the original
-    char *buffer_copy = strdup(buffer);
-    if (buffer_copy == NULL) {
-        *output = NULL;
-        return;
+    if (record->type == WAL_CREATE_ACCOUNT) {
+        CurrencyAccount *account = createCurrencyAccount(user, record->amount_from, record->is_shared);
+        if (account == NULL) return 0;
+        addTransaction(db, user->client_id, account->account_id, "CREATE_ACCOUNT",
+                      "Euro", "", record->amount_from, 0, 0);
+        return 1;
     }
     
-    char *token = strtok(buffer_copy, DELIMS);
-    while (token != NULL) {
-        char **temp = realloc(tokens, (token_count + 1) * sizeof(char *));
-        if (temp == NULL) {
-            // Cleanup on allocation failure
-            for (int i = 0; i < token_count; i++) {
-                free(tokens[i]);
+    int account_index = findCurrencyAccount(user, record->account_id);
+    if (account_index == -1) return 0;
+    CurrencyAccount *account = &user->currencyAccounts[account_index];
+    
+    switch (record->type) {
+        case WAL_DEPOSIT:
+            if (!applyLoggedBalance(account, record->currency_from, record->amount_from)) return 0;
+            addTransaction(db, user->client_id, account->account_id, "DEPOSIT",
+                          getCurrencyName(record->currency_from), "", record->amount_from, 0, 0);
+            return 1;
+        case WAL_WITHDRAW:
+            if (!applyLoggedBalance(account, record->currency_from, -record->amount_from)) return 0;
+            addTransaction(db, user->client_id, account->account_id, "WITHDRAW",
+                          getCurrencyName(record->currency_from), "", record->amount_from, 0, 0);
+            return 1;
+        case WAL_EXCHANGE:
+            if (!applyLoggedBalance(account, record->currency_from, -record->amount_from)) return 0;
+            if (!applyLoggedBalance(account, record->currency_to, record->amount_to)) {
+                applyLoggedBalance(account, record->currency_from, record->amount_from);
+                return 0;
             }
-            free(tokens);
-            free(buffer_copy);
-            *output = NULL;
-            return;
+            addTransaction(db, user->client_id, account->account_id, "EXCHANGE",
+                          getCurrencyName(record->currency_from), getCurrencyName(record->currency_to),
+                          record->amount_from, record->amount_to,
+                          fromMinorUnits(record->currency_to, record->amount_to) /
+                          fromMinorUnits(record->currency_from, record->amount_from));
+            return 1;
+        case WAL_TRANSFER: {
+            WalTransferTarget target;
+            memcpy(&target, record->username, sizeof(target));
+            int recipient_index = findUserByClientId(db, target.client_id);
+            if (recipient_index == -1) return 0;
+            UserAccount *recipient = &db->userAccountArr[recipient_index];
+            int to_index = findCurrencyAccount(recipient, target.account_id);
+            if (to_index == -1) return 0;
+            CurrencyAccount *to = &recipient->currencyAccounts[to_index];
+            
+            if (!applyLoggedBalance(account, record->currency_from, -record->amount_from)) return 0;
+            if (!applyLoggedBalance(to, record->currency_from, record->amount_from)) {
+                applyLoggedBalance(account, record->currency_from, record->amount_from);
+                return 0;
+            }
+            addTransferTransactions(db, user, account->account_id, recipient, to->account_id,
+                                    record->currency_from, record->amount_from);
+            return 1;
         }
-        tokens = temp;
+        case WAL_DELETE_ACCOUNT:
+            return deleteCurrencyAccount(user, account_index + 1);
+        default:
+            return 0;
+    }
+}
+
+int replayWriteAheadLog(ServerDatabase *db, const char *filename) {
+    int fd = open(filename, O_RDWR);
+    if (fd == -1) return 0;
+    
+    WalRecord record;
+    int replayed = 0;
+    off_t valid_end = 0;
+    WalRecord *batch = NULL;
+    int batch_cap = 0;
+    
+    while (read(fd, &record, sizeof(WalRecord)) == (ssize_t)sizeof(WalRecord)) {
+        if (!verifyWalRecord(&record)) break;
         
-        tokens[token_count] = strdup(token);
-        if (tokens[token_count] == NULL) {
-            // Cleanup on strdup failure
-            for (int i = 0; i < token_count; i++) {
-                free(tokens[i]);
+        // A batch transfer only counts once all of its records are on disk;
+        // a batch cut short by a crash is dropped with the rest of the tail
+        int count = 1;
+        if (record.type == WAL_TRANSFER) {
+            WalTransferTarget target;
+            memcpy(&target, record.username, sizeof(target));
+            if (target.batch_remaining > 0 && target.batch_remaining < BATCH_TRANSFER_MAX_ITEMS) {
+                count += target.batch_remaining;
             }
-            free(tokens);
-            free(buffer_copy);
-            *output = NULL;
-            return;
         }
+        if (count > batch_cap) {
+            WalRecord *temp = realloc(batch, count * sizeof(WalRecord));
+            if (temp == NULL) break;
+            batch = temp;
+            batch_cap = count;
+        }
+        batch[0] = record;
+        int complete = 1;
+        while (complete < count &&
+               read(fd, &batch[complete], sizeof(WalRecord)) == (ssize_t)sizeof(WalRecord) &&
+               verifyWalRecord(&batch[complete])) {
+            complete++;
+        }
+        if (complete < count) break;
+        valid_end += count * sizeof(WalRecord);
         
-        token_count++;
-        token = strtok(NULL, DELIMS);
-    }
-    
-    // Add NULL terminator
-    if (token_count > 0) {
-        char **temp = realloc(tokens, (token_count + 1) * sizeof(char *));
-        if (temp == NULL) {
-            for (int i = 0; i < token_count; i++) {
-                free(tokens[i]);
+        for (int i = 0; i < count; i++) {
+            // Records already folded into the snapshot are skipped
+            if (batch[i].sequence <= db->wal_sequence) continue;
+            if (batch[i].format == 0) upgradeLegacyWalRecord(&batch[i]);
+            
+            if (!applyWalRecord(db, &batch[i])) {
+                printf("Write-ahead log record %ld could not be applied\n", batch[i].sequence);
             }
-            free(tokens);
-            free(buffer_copy);
-            *output = NULL;
-            return;
+            db->wal_sequence = batch[i].sequence;
+            replayed++;
         }
-        tokens = temp;
-        tokens[token_count] = NULL;
     }
+    free(batch);
     
-    free(buffer_copy);
-    *output = tokens;
+    // Drop a torn or corrupt tail so new records follow the last good one
+    if (ftruncate(fd, valid_end) == -1) {
+        perror("Error trimming write-ahead log");
+    }
+    close(fd);
+    
+    if (replayed > 0) {
+        printf("Replayed %d write-ahead log records.\n", replayed);
+    }
+    return replayed;
+}
+
+// ============================================================
+// Currency Exchange Functions
+// ============================================================
+
+static const char *currency_names[CURRENCY_COUNT] = {
+    "Euro", "Dollar", "Pound", "Yen", "Rupee", "Peso", "Franc", "Drachmas"
+};
+
+// Minor units per major unit of each currency (Yen has no subdivision)
+static const Money currency_scale[CURRENCY_COUNT] = { 100, 100, 100, 1, 100, 100, 100, 100 };
+
+// Conversions multiply two 64-bit quantities before dividing
+__extension__ typedef __int128 WideMoney;
+
+int getCurrencyIndex(const char *currency_name) {
+    for (int i = 0; i < CURRENCY_COUNT; i++) {
+        if (strcmp(currency_name, currency_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+const char* getCurrencyName(int index) {
+    if (index < 0 || index >= CURRENCY_COUNT) return "Unknown";
+    return currency_names[index];
+}
+
+Money currencyScale(int currency_index) {
+    if (currency_index < 0 || currency_index >= CURRENCY_COUNT) return 0;
+    return currency_scale[currency_index];
+}
+
+int toMinorUnits(int currency_index, double amount, Money *result) {
+    // Amounts typed by users are rounded half away from zero to the nearest minor unit
+    Money scale = currencyScale(currency_index);
+    if (scale == 0 || amount != amount) return 0;
+    
+    double scaled = amount * scale;
+    if (scaled >= 9.2e18 || scaled <= -9.2e18) return 0;
+    *result = (Money)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    return 1;
+}
+
+double fromMinorUnits(int currency_index, Money amount) {
+    Money scale = currencyScale(currency_index);
+    return scale > 0 ? (double)amount / scale : 0.0;
+}
+
+static Money greatestCommonDivisor(Money a, Money b) {
+    while (b != 0) {
+        Money t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+void buildExchangeTable(ExchangeTable *table, const Coins *rates) {
+    // Rates to Euro as integer millionths; 0 marks an unusable rate
+    Money millionths[CURRENCY_COUNT];
+    for (int i = 0; i < CURRENCY_COUNT; i++) {
+        double rate = rates->rate[i];
+        millionths[i] = rate > 0 && rate * RATE_SCALE < 4e9 ? (Money)(rate * RATE_SCALE + 0.5) : 0;
+    }
+    
+    // from -> to multiplies by to_rate * to_scale and divides by from_rate * from_scale,
+    // reduced so the 128-bit product in applyExchangeRates stays small
+    for (int from = 0; from < CURRENCY_COUNT; from++) {
+        for (int to = 0; to < CURRENCY_COUNT; to++) {
+            CrossRate *cross = &table->cross[from][to];
+            if (millionths[from] == 0 || millionths[to] == 0) {
+                cross->numerator = 0;
+                cross->denominator = 0;
+                cross->fast_limit = 0;
+                continue;
+            }
+            Money numerator = millionths[to] * currency_scale[to];
+            Money denominator = millionths[from] * currency_scale[from];
+            Money divisor = greatestCommonDivisor(numerator, denominator);
+            cross->numerator = numerator / divisor;
+            cross->denominator = denominator / divisor;
+            cross->fast_limit = INT64_MAX / cross->numerator;
+        }
+    }
+}
+
+// ============================================================
+// Currency Aggregates
+// ============================================================
+
+// Index of the calling thread, handed out round-robin on first use;
+// per-thread counter tables take it modulo their size
+static __thread int thread_slot = -1;
+static int next_thread_slot = 0;
+
+static int threadSlot() {
+    if (thread_slot == -1) {
+        thread_slot = __atomic_fetch_add(&next_thread_slot, 1, __ATOMIC_RELAXED);
+    }
+    return thread_slot;
+}
+
+// Amount of each currency held across all accounts, kept as per-thread
+// deltas so balance updates on different threads never share a cache line.
+// The total is the sum over all slots; deltas wrap, so sums are unsigned.
+typedef struct {
+    Money coins[CURRENCY_COUNT];
+} __attribute__((aligned(64))) CurrencyTotalSlot;
+
+static CurrencyTotalSlot currency_totals[CURRENCY_TOTAL_SLOTS];
+
+static void addCurrencyTotal(int currency_index, Money amount) {
+    Money *total = &currency_totals[threadSlot() % CURRENCY_TOTAL_SLOTS].coins[currency_index];
+    __atomic_add_fetch(total, amount, __ATOMIC_RELAXED);
+}
+
+void readCurrencyTotals(Money totals[CURRENCY_COUNT]) {
+    uint64_t sums[CURRENCY_COUNT] = {0};
+    for (int s = 0; s < CURRENCY_TOTAL_SLOTS; s++) {
+        for (int c = 0; c < CURRENCY_COUNT; c++) {
+            sums[c] += (uint64_t)__atomic_load_n(&currency_totals[s].coins[c], __ATOMIC_RELAXED);
+        }
+    }
+    for (int c = 0; c < CURRENCY_COUNT; c++) {
+        totals[c] = (Money)sums[c];
+    }
+}
+
+static void scanCurrencyTotals(ServerDatabase *db, Money totals[CURRENCY_COUNT]) {
+    // Walk every account; the caller keeps the tables from changing
+    uint64_t sums[CURRENCY_COUNT] = {0};
+    for (int u = 0; u < db->totalUsers; u++) {
+        UserAccount *user = &db->userAccountArr[u];
+        for (int a = 0; a < user->currencyAccountNum; a++) {
+            for (int c = 0; c < CURRENCY_COUNT; c++) {
+                sums[c] += (uint64_t)getCurrencyBalance(&user->currencyAccounts[a], c);
+            }
+        }
+    }
+    for (int c = 0; c < CURRENCY_COUNT; c++) {
+        totals[c] = (Money)sums[c];
+    }
+}
+
+void rebuildCurrencyTotals(ServerDatabase *db) {
+    // Replay and snapshot loading set balances directly, so the running
+    // totals start from a full scan
+    pthread_rwlock_wrlock(&db->lock);
+    Money scanned[CURRENCY_COUNT];
+    scanCurrencyTotals(db, scanned);
+    memset(currency_totals, 0, sizeof(currency_totals));
+    memcpy(currency_totals[0].coins, scanned, sizeof(scanned));
+    pthread_rwlock_unlock(&db->lock);
+}
+
+int auditCurrencyTotals(ServerDatabase *db) {
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    
+    // Compare while no request step runs, so both sides see the same balances
+    Money running[CURRENCY_COUNT], scanned[CURRENCY_COUNT];
+    pthread_rwlock_wrlock(&db->lock);
+    readCurrencyTotals(running);
+    scanCurrencyTotals(db, scanned);
+    pthread_rwlock_unlock(&db->lock);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    
+    int mismatches = 0;
+    for (int c = 0; c < CURRENCY_COUNT; c++) {
+        bool match = running[c] == scanned[c];
+        if (!match) mismatches++;
+        printf("  %-9s running %.2f  scanned %.2f  %s\n", getCurrencyName(c),
+               fromMinorUnits(c, running[c]), fromMinorUnits(c, scanned[c]), match ? "ok" : "MISMATCH");
+    }
+    printf("Audit of %d users finished in %.1f ms: %s\n", db->totalUsers,
+           (finished.tv_sec - started.tv_sec) * 1000.0 + (finished.tv_nsec - started.tv_nsec) / 1e6,
+           mismatches == 0 ? "all totals match" : "totals DIFFER");
+    return mismatches == 0;
+}
+
+// ============================================================
+// Exchange Rate Publication (read-copy-update)
+// ============================================================
+
+const RateSet* acquireRates(ServerDatabase *db, RateReadGuard *guard) {
+    // Readers only bump a counter on their own slot, so they never wait
+    // for a publication and never contend with readers on other threads
+    guard->slot = &db->rate_readers[threadSlot() % RATE_READER_SLOTS];
+    guard->parity = __atomic_load_n(&db->rate_parity, __ATOMIC_SEQ_CST) & 1;
+    __atomic_add_fetch(&guard->slot->readers[guard->parity], 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&db->rates, __ATOMIC_SEQ_CST);
+}
+
+void releaseRates(RateReadGuard *guard) {
+    __atomic_sub_fetch(&guard->slot->readers[guard->parity], 1, __ATOMIC_RELEASE);
+}
+
+static void waitForRateReaders(ServerDatabase *db, int parity) {
+    for (int i = 0; i < RATE_READER_SLOTS; i++) {
+        while (__atomic_load_n(&db->rate_readers[i].readers[parity], __ATOMIC_ACQUIRE) != 0) {
+            sched_yield();
+        }
+    }
+}
+
+// Swap in a new rate set; the caller holds rate_update_lock
+static void swapExchangeRates(ServerDatabase *db, const Coins *rates) {
+    RateSet *next = malloc(sizeof(RateSet));
+    memoryAllocationCheck(next);
+    next->rates = *rates;
+    buildExchangeTable(&next->table, rates);
+    
+    RateSet *previous = __atomic_exchange_n(&db->rates, next, __ATOMIC_SEQ_CST);
+    if (previous != NULL) {
+        // Grace period: a reader that may still hold the previous set counted
+        // itself in one half before the swap. Drain stragglers left in the
+        // idle half by the last flip, point new readers at it, then drain the
+        // half that was current. New readers only ever see the new set.
+        int parity = db->rate_parity & 1;
+        waitForRateReaders(db, parity ^ 1);
+        __atomic_store_n(&db->rate_parity, parity ^ 1, __ATOMIC_SEQ_CST);
+        waitForRateReaders(db, parity);
+        free(previous);
+    }
+}
+
+void setExchangeRates(ServerDatabase *db, const Coins *rates) {
+    pthread_mutex_lock(&db->rate_update_lock);
+    swapExchangeRates(db, rates);
+    pthread_mutex_unlock(&db->rate_update_lock);
+}
+
+int validExchangeRates(const Coins *rates) {
+    // Rates are quoted against the Euro and must fit the cross-rate table
+    if (rates->rate[CURRENCY_EURO] != 1.0) return 0;
+    for (int i = 0; i < CURRENCY_COUNT; i++) {
+        double rate = rates->rate[i];
+        if (!(rate > 0) || rate * RATE_SCALE >= 4e9) return 0;
+    }
+    return 1;
+}
+
+_Static_assert(sizeof(Coins) <= CREDENTIAL_SIZE, "rate records carry Coins in the username field");
+
+// Swap in and log a rate set; the caller holds rate_update_lock, so
+// publications are logged in the order they took effect
+static int publishLockedExchangeRates(ServerDatabase *db, const Coins *rates) {
+    if (!validExchangeRates(rates)) return 0;
+    
+    // Publish before logging: a snapshot that covers the record's sequence
+    // then always holds the new rates too
+    swapExchangeRates(db, rates);
+    
+    WalRecord record = {0};
+    record.type = WAL_SET_RATES;
+    memcpy(record.username, rates, sizeof(Coins));
+    appendWalRecord(db, &record);
+    
+    // Every account's Euro total moves with the rates
+    requestRevaluation();
+    return 1;
+}
+
+int publishExchangeRates(ServerDatabase *db, const Coins *rates) {
+    pthread_mutex_lock(&db->rate_update_lock);
+    int published = publishLockedExchangeRates(db, rates);
+    pthread_mutex_unlock(&db->rate_update_lock);
+    return published;
+}
+
+int publishExchangeRate(ServerDatabase *db, int currency_index, double rate) {
+    if (currency_index < 0 || currency_index >= CURRENCY_COUNT) return 0;
+    
+    // Read, change and publish under one lock, so a publication in between
+    // is never undone; the current set cannot be freed while it is held
+    pthread_mutex_lock(&db->rate_update_lock);
+    Coins rates = db->rates->rates;
+    rates.rate[currency_index] = rate;
+    int published = publishLockedExchangeRates(db, &rates);
+    pthread_mutex_unlock(&db->rate_update_lock);
+    return published;
+}
+
+int applyExchangeRates(const ExchangeTable *table, Money amount, int from_currency,
+                       Money *result, int to_currency) {
+    if (from_currency < 0 || from_currency >= CURRENCY_COUNT ||
+        to_currency < 0 || to_currency >= CURRENCY_COUNT) {
+        return 0;
+    }
+    
+    const CrossRate *cross = &table->cross[from_currency][to_currency];
+    if (cross->denominator == 0) return 0;
+    
+    // One multiply by the precomputed factor, exact in 128 bits
+    WideMoney magnitude = amount < 0 ? -(WideMoney)amount : (WideMoney)amount;
+    WideMoney numerator = magnitude * cross->numerator;
+    WideMoney quotient = numerator / cross->denominator;
+    WideMoney remainder = numerator % cross->denominator;
+    
+    // Round half to even so repeated conversions carry no systematic bias
+    if (2 * remainder > cross->denominator || (2 * remainder == cross->denominator && (quotient & 1))) {
+        quotient++;
+    }
+    if (quotient > INT64_MAX) return 0;
+    
+    *result = amount < 0 ? -(Money)quotient : (Money)quotient;
+    return 1;
+}
+
+size_t convertCurrencyBatch(const ExchangeTable *table, const uint8_t *from, const uint8_t *to,
+                            const Money *amounts, Money *results, uint8_t *converted, size_t count) {
+    // The cross table is read as one flat array. Amounts whose product with
+    // the numerator fits 64 bits (nearly all of them) take a branch-light
+    // integer path with the same half-to-even rounding as applyExchangeRates;
+    // the rest fall back to it for the 128-bit arithmetic.
+    const CrossRate *cross = &table->cross[0][0];
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        bool known = from[i] < CURRENCY_COUNT && to[i] < CURRENCY_COUNT;
+        const CrossRate *rate = &cross[known ? from[i] * CURRENCY_COUNT + to[i] : 0];
+        Money amount = amounts[i];
+        uint64_t magnitude = amount < 0 ? -(uint64_t)amount : (uint64_t)amount;
+        
+        if (known && magnitude <= (uint64_t)rate->fast_limit) {
+            uint64_t numerator = magnitude * (uint64_t)rate->numerator;
+            uint64_t denominator = (uint64_t)rate->denominator;
+            uint64_t quotient = numerator / denominator;
+            uint64_t remainder = numerator - quotient * denominator;
+            quotient += (2 * remainder > denominator) | ((2 * remainder == denominator) & (quotient & 1));
+            results[i] = amount < 0 ? -(Money)quotient : (Money)quotient;
+            converted[i] = 1;
+        } else {
+            converted[i] = known && applyExchangeRates(table, amount, from[i], &results[i], to[i]);
+            if (!converted[i]) results[i] = 0;
+        }
+        total += converted[i];
+    }
+    return total;
+}
+
+Money getCurrencyBalance(CurrencyAccount *account, int currency_index) {
+    if (currency_index < 0 || currency_index >= CURRENCY_COUNT) return 0;
+    return __atomic_load_n(&account->coins[currency_index], __ATOMIC_RELAXED);
+}
+
+// Euro cents a balance is worth; balances too large to convert count as 0
+static Money euroValue(const ExchangeTable *table, int currency_index, Money balance) {
+    Money in_euros = 0;
+    return applyExchangeRates(table, balance, currency_index, &in_euros, CURRENCY_EURO) ? in_euros : 0;
+}
+
+// Lock-free single-balance update: retry the compare-and-swap until no other
+// writer changed the balance in between, rejecting overflow and overdrafts on
+// every attempt. The Euro total is left to the caller; previous, if given,
+// receives the balance the update replaced.
+int updateCurrencyBalanceAtomic(CurrencyAccount *account, int currency_index, Money amount,
+                                Money *previous) {
+    if (currency_index < 0 || currency_index >= CURRENCY_COUNT) return 0;
+    Money *balance = &account->coins[currency_index];
+    
+    Money current = __atomic_load_n(balance, __ATOMIC_RELAXED);
+    Money updated;
+    do {
+        if (__builtin_add_overflow(current, amount, &updated) || updated < 0) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(balance, &current, updated, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    addCurrencyTotal(currency_index, amount);
+    if (previous != NULL) *previous = current;
+    return 1;
+}
+
+// Change one balance and the account's Euro total together. The caller
+// holds the account's stripe, so both land in one seqlock write section
+// and readAccount never sees a balance without its total; the stripe also
+// keeps the change ordered with its log record. The balance itself goes
+// through the compare-and-swap, which never retries while the stripe is held.
+int updateCurrencyBalance(CurrencyAccount *account, int currency_index, Money amount,
+                          const ExchangeTable *table) {
+    Money previous;
+    if (!updateCurrencyBalanceAtomic(account, currency_index, amount, &previous)) {
+        return 0;
+    }
+    
+    // Move the Euro total by exactly what this balance's Euro value changed,
+    // so successive updates add up to the total a full revaluation computes
+    if (table != NULL) {
+        Money delta = euroValue(table, currency_index, previous + amount) -
+                      euroValue(table, currency_index, previous);
+        __atomic_store_n(&account->total_balance,
+                         __atomic_load_n(&account->total_balance, __ATOMIC_RELAXED) + delta,
+                         __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+void refreshAccountTotal(CurrencyAccount *account, const ExchangeTable *table) {
+    // Sum every balance converted to Euro cents; like a balance update this
+    // runs under the account's stripe
+    static const uint8_t currencies[CURRENCY_COUNT] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    static const uint8_t euro[CURRENCY_COUNT] = { 0 };
+    Money balances[CURRENCY_COUNT], in_euros[CURRENCY_COUNT];
+    uint8_t converted[CURRENCY_COUNT];
+    for (int i = 0; i < CURRENCY_COUNT; i++) {
+        balances[i] = getCurrencyBalance(account, i);
+    }
+    convertCurrencyBatch(table, currencies, euro, balances, in_euros, converted, CURRENCY_COUNT);
+    
+    Money total = 0;
+    for (int i = 0; i < CURRENCY_COUNT; i++) {
+        if (__builtin_add_overflow(total, in_euros[i], &total)) {
+            total = INT64_MAX;
+            break;
+        }
+    }
+    __atomic_store_n(&account->total_balance, total, __ATOMIC_RELAXED);
+}
+
+// ============================================================
+// Slab Allocator
+// ============================================================
+
+void initializeSlabAllocator(SlabAllocator *slab, size_t slot_size, size_t slots_per_block) {
+    // Slots double as free-list links, so keep them pointer sized and aligned
+    size_t align = sizeof(void *) > sizeof(Money) ? sizeof(void *) : sizeof(Money);
+    if (slot_size < sizeof(void *)) slot_size = sizeof(void *);
+    slab->slot_size = (slot_size + align - 1) / align * align;
+    slab->slots_per_block = slots_per_block > 0 ? slots_per_block : 1;
+    slab->blocks = NULL;
+    slab->free_list = NULL;
+    slab->live_slots = 0;
+    slab->block_count = 0;
+}
+
+void* slabAllocate(SlabAllocator *slab) {
+    // Reuse a released slot first
+    if (slab->free_list != NULL) {
+        void *slot = slab->free_list;
+        memcpy(&slab->free_list, slot, sizeof(void *));
+        slab->live_slots++;
+        return slot;
+    }
+    
+    // Otherwise carve the next slot from the newest block, adding one when it is full
+    if (slab->blocks == NULL || slab->blocks->used == slab->slots_per_block) {
+        SlabBlock *block = malloc(sizeof(SlabBlock) + slab->slot_size * slab->slots_per_block);
+        if (block == NULL) {
+            perror("Failed to allocate slab block");
+            return NULL;
+        }
+        block->next = slab->blocks;
+        block->used = 0;
+        slab->blocks = block;
+        slab->block_count++;
+    }
+    
+    void *slot = slab->blocks->slots + slab->blocks->used * slab->slot_size;
+    slab->blocks->used++;
+    slab->live_slots++;
+    return slot;
+}
+
+void slabRelease(SlabAllocator *slab, void *slot) {
+    if (slot == NULL) return;
+    memcpy(slot, &slab->free_list, sizeof(void *));
+    slab->free_list = slot;
+    slab->live_slots--;
+}
+
+void destroySlabAllocator(SlabAllocator *slab) {
+    // Bulk release: one free per block, however many slots were handed out
+    SlabBlock *block = slab->blocks;
+    while (block != NULL) {
+        SlabBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    slab->blocks = NULL;
+    slab->free_list = NULL;
+    slab->live_slots = 0;
+    slab->block_count = 0;
+}
+
+// ============================================================
+// Transaction History Functions
+// ============================================================
+
+static int transaction_id_counter = 1;
+
+// Append one transaction to a user's history; history_lock must be held for writing
+static Transaction* appendTransaction(ServerDatabase *db, UserAccount *user, int account_id,
+                                      const char *type, const char *from_currency, const char *to_currency,
+                                      Money amount_from, Money amount_to, double exchange_rate) {
+    // Grow the user's history geometrically so appends stay amortized O(1)
+    if (user->historyCount == user->historyCapacity) {
+        int new_capacity = user->historyCapacity > 0 ? user->historyCapacity * 2 : 16;
+        Transaction **temp = realloc(user->history, new_capacity * sizeof(Transaction *));
+        if (temp == NULL) {
+            perror("Failed to grow transaction history");
+            return NULL;
+        }
+        user->history = temp;
+        user->historyCapacity = new_capacity;
+    }
+    
+    Transaction *new_transaction = slabAllocate(&db->transaction_slab);
+    if (new_transaction == NULL) {
+        perror("Failed to allocate transaction");
+        return NULL;
+    }
+    
+    new_transaction->transaction_id = transaction_id_counter++;
+    new_transaction->client_id = user->client_id;
+    new_transaction->account_id = account_id;
+    strcpy(new_transaction->transaction_type, type);
+    strcpy(new_transaction->currency_from, from_currency);
+    strcpy(new_transaction->currency_to, to_currency);
+    new_transaction->amount_from = amount_from;
+    new_transaction->amount_to = amount_to;
+    new_transaction->exchange_rate = exchange_rate;
+    new_transaction->timestamp = time(NULL);
+    new_transaction->linked_transaction_id = 0;
+    
+    user->history[user->historyCount++] = new_transaction;
+    return new_transaction;
+}
+
+void addTransaction(ServerDatabase *db, int client_id, int account_id, 
+                   const char *type, const char *from_currency, const char *to_currency,
+                   Money amount_from, Money amount_to, double exchange_rate) {
+    int user_index = findUserByClientId(db, client_id);
+    if (user_index == -1) return;
+    UserAccount *user = &db->userAccountArr[user_index];
+    
+    // Sessions on different accounts of one user append to the same history
+    pthread_rwlock_wrlock(&db->history_lock);
+    appendTransaction(db, user, account_id, type, from_currency, to_currency,
+                      amount_from, amount_to, exchange_rate);
+    pthread_rwlock_unlock(&db->history_lock);
+}
+
+// Both halves of a transfer are appended together and point at each other
+static void appendTransferPair(ServerDatabase *db, UserAccount *sender, int sender_account_id,
+                               UserAccount *recipient, int recipient_account_id, int currency, Money amount) {
+    const char *coin_name = getCurrencyName(currency);
+    Transaction *sent = appendTransaction(db, sender, sender_account_id, "TRANSFER_OUT",
+                                          coin_name, "", amount, 0, 0);
+    Transaction *received = appendTransaction(db, recipient, recipient_account_id, "TRANSFER_IN",
+                                              coin_name, "", amount, 0, 0);
+    if (sent != NULL && received != NULL) {
+        sent->linked_transaction_id = received->transaction_id;
+        received->linked_transaction_id = sent->transaction_id;
+    }
+}
+
+void addTransferTransactions(ServerDatabase *db, UserAccount *sender, int sender_account_id,
+                             UserAccount *recipient, int recipient_account_id, int currency, Money amount) {
+    pthread_rwlock_wrlock(&db->history_lock);
+    appendTransferPair(db, sender, sender_account_id, recipient, recipient_account_id, currency, amount);
+    pthread_rwlock_unlock(&db->history_lock);
+}
+
+void addBatchTransferTransactions(ServerDatabase *db, UserAccount *sender, int sender_account_id,
+                                  const BatchTransferItem *items, int count) {
+    // One lock hold for the whole batch
+    pthread_rwlock_wrlock(&db->history_lock);
+    for (int i = 0; i < count; i++) {
+        if (!items[i].applied) continue;
+        appendTransferPair(db, sender, sender_account_id, items[i].recipient, items[i].to->account_id,
+                           items[i].currency, items[i].amount);
+    }
+    pthread_rwlock_unlock(&db->history_lock);
+}
+
+int getTransactionHistoryPage(UserAccount *user, long cursor, int limit, int *first) {
+    // A cursor is the history position just past the page to return; pages
+    // run newest to oldest, so the next cursor is this page's first position
+    if (cursor == HISTORY_CURSOR_LATEST || cursor > user->historyCount) {
+        cursor = user->historyCount;
+    }
+    if (cursor < 0) cursor = 0;
+    if (limit < 1 || limit > HISTORY_PAGE_SIZE) limit = HISTORY_PAGE_SIZE;
+    
+    *first = cursor > limit ? (int)cursor - limit : 0;
+    return (int)cursor - *first;
+}
+
+void freeTransactionHistory(UserAccount *user) {
+    // The records themselves belong to the database's transaction slab
+    free(user->history);
+    user->history = NULL;
+    user->historyCount = 0;
+    user->historyCapacity = 0;
+}
+
+void printTransaction(const Transaction *transaction) {
+    char buffer[MAX_SIZE];
+    struct tm *timeinfo = localtime(&transaction->timestamp);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
+    
+    printf("Transaction %d: %s - %s %.2f to %s %.2f (Rate: %lf) at %s\n",
+           transaction->transaction_id, transaction->transaction_type,
+           transaction->currency_from,
+           fromMinorUnits(getCurrencyIndex(transaction->currency_from), transaction->amount_from),
+           transaction->currency_to,
+           fromMinorUnits(getCurrencyIndex(transaction->currency_to), transaction->amount_to),
+           transaction->exchange_rate, buffer);
+    if (transaction->linked_transaction_id != 0) {
+        printf("  Linked to transaction %d\n", transaction->linked_transaction_id);
+    }
+}
+
+// ============================================================
+// User Authentication and Management
+// ============================================================
+
+// ============================================================
+// Username Hash Index (open addressing, linear probing)
+// ============================================================
+
+static unsigned int hashUsername(const char *username) {
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    while (*username) {
+        hash ^= (unsigned char)*username++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Slots hold user_index + 1 so that 0 marks an empty slot
+static void placeUsername(ServerDatabase *db, int user_index) {
+    unsigned int mask = db->usernameIndexSize - 1;
+    unsigned int slot = hashUsername(db->userAccountArr[user_index].username) & mask;
+    while (db->usernameIndex[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    db->usernameIndex[slot] = user_index + 1;
+}
+
+int buildUsernameIndex(ServerDatabase *db, int min_users) {
+    // Keep the load factor at or below one half so probe chains stay short
+    int size = USERNAME_INDEX_MIN_SIZE;
+    while (size < 2 * min_users) {
+        size *= 2;
+    }
+    
+    int *index = calloc(size, sizeof(int));
+    if (index == NULL) {
+        perror("Failed to allocate username index");
+        return 0;
+    }
+    free(db->usernameIndex);
+    db->usernameIndex = index;
+    db->usernameIndexSize = size;
+    
+    for (int i = 0; i < db->totalUsers; i++) {
+        placeUsername(db, i);
+    }
+    return 1;
+}
+
+int indexUsername(ServerDatabase *db, int user_index) {
+    if (db->usernameIndex == NULL || 2 * (db->totalUsers + 1) > db->usernameIndexSize) {
+        // Users up to and including user_index are already in userAccountArr
+        if (!buildUsernameIndex(db, db->totalUsers + 1)) return 0;
+        if (user_index < db->totalUsers) return 1;
+    }
+    placeUsername(db, user_index);
+    return 1;
+}
+
+void unindexUsername(ServerDatabase *db, const char *username) {
+    if (db->usernameIndex == NULL) return;
+    
+    unsigned int mask = db->usernameIndexSize - 1;
+    unsigned int slot = hashUsername(username) & mask;
+    while (db->usernameIndex[slot] != 0 &&
+           strcmp(db->userAccountArr[db->usernameIndex[slot] - 1].username, username) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    if (db->usernameIndex[slot] == 0) return;
+    
+    // Backward-shift deletion: pull later entries of the probe chain into the
+    // hole so lookups never need tombstones
+    unsigned int hole = slot;
+    db->usernameIndex[hole] = 0;
+    for (unsigned int next = (hole + 1) & mask; db->usernameIndex[next] != 0; next = (next + 1) & mask) {
+        unsigned int home = hashUsername(db->userAccountArr[db->usernameIndex[next] - 1].username) & mask;
+        // Move the entry unless its home lies cyclically in (hole, next]
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            db->usernameIndex[hole] = db->usernameIndex[next];
+            db->usernameIndex[next] = 0;
+            hole = next;
+        }
+    }
+}
+
+int findUserByUsername(ServerDatabase *db, const char *username) {
+    if (db->usernameIndex == NULL) return -1;
+    
+    unsigned int mask = db->usernameIndexSize - 1;
+    unsigned int slot = hashUsername(username) & mask;
+    while (db->usernameIndex[slot] != 0) {
+        int user_index = db->usernameIndex[slot] - 1;
+        if (strcmp(db->userAccountArr[user_index].username, username) == 0) {
+            return user_index;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+int authenticateUser(ServerDatabase *db, const char *username, const char *password) {
+    int user_index = findUserByUsername(db, username);
+    if (user_index == -1) return -1; // User not found
+    
+    if (strcmp(db->userAccountArr[user_index].password, password) == 0) {
+        return user_index;
+    }
+    return -1; // Wrong password
+}
+
+int findUserByClientId(ServerDatabase *db, int client_id) {
+    // Client ids are handed out sequentially, so the slot is usually client_id - 1
+    int guess = client_id - 1;
+    if (guess >= 0 && guess < db->totalUsers && db->userAccountArr[guess].client_id == client_id) {
+        return guess;
+    }
+    for (int i = 0; i < db->totalUsers; i++) {
+        if (db->userAccountArr[i].client_id == client_id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int createNewUser(ServerDatabase *db, const char *username, const char *password) {
+    // Credentials must fit a write-ahead log record
+    if (strlen(username) >= CREDENTIAL_SIZE || strlen(password) >= CREDENTIAL_SIZE) {
+        return 0;
+    }
+    if (findUserByUsername(db, username) != -1) {
+        return 0; // Username already exists
+    }
+    
+    // Reallocate user array
+    UserAccount *temp = realloc(db->userAccountArr, (db->totalUsers + 1) * sizeof(UserAccount));
+    if (!temp) return 0;
+    db->userAccountArr = temp;
+    
+    // Initialize new user
+    UserAccount *new_user = &db->userAccountArr[db->totalUsers];
+    new_user->client_id = db->userid++;
+    new_user->coin_account_id_counter = 1;
+    new_user->currencyAccountNum = 0;
+    new_user->currencyAccounts = NULL;
+    new_user->history = NULL;
+    new_user->historyCount = 0;
+    new_user->historyCapacity = 0;
+    
+    new_user->username = malloc(strlen(username) + 1);
+    strcpy(new_user->username, username);
+    
+    new_user->password = malloc(strlen(password) + 1);
+    strcpy(new_user->password, password);
+    
+    indexUsername(db, db->totalUsers);
+    db->totalUsers++;
+    return 1;
+}
+
+// ============================================================
+// Currency Exchange Operations
+// ============================================================
+
+CurrencyAccount* createCurrencyAccount(UserAccount *user, Money initial_deposit, int is_shared) {
+    // Reallocate memory for new account and initialize it
+    CurrencyAccount *temp = realloc(user->currencyAccounts,
+                                    (user->currencyAccountNum + 1) * sizeof(CurrencyAccount));
+    if (temp == NULL) {
+        perror("Failed to allocate memory for a new currency account\n");
+        return NULL;
+    }
+    user->currencyAccounts = temp;
+
+    CurrencyAccount *account = &user->currencyAccounts[user->currencyAccountNum];
+    memset(account, 0, sizeof(CurrencyAccount));
+    account->coins[CURRENCY_EURO] = initial_deposit;
+    account->total_balance = initial_deposit;
+    account->is_shared = is_shared;
+    addCurrencyTotal(CURRENCY_EURO, initial_deposit);
+    account->account_id = user->coin_account_id_counter++;
+    user->currencyAccountNum++;
+    return account;
+}
+
+int deleteCurrencyAccount(UserAccount *user, int account_index) {
+    if (account_index < 1 || account_index > user->currencyAccountNum) {
+        return 0;
+    }
+    
+    // Its balances leave the system with it
+    for (int c = 0; c < CURRENCY_COUNT; c++) {
+        addCurrencyTotal(c, -getCurrencyBalance(&user->currencyAccounts[account_index - 1], c));
+    }
+    
+    // Shift accounts array
+    for (int i = account_index - 1; i < user->currencyAccountNum - 1; i++) {
+        user->currencyAccounts[i] = user->currencyAccounts[i + 1];
+    }
+    user->currencyAccountNum--;
+    
+    // Reallocate to smaller size
+    CurrencyAccount *temp = realloc(user->currencyAccounts, 
+                                    user->currencyAccountNum * sizeof(CurrencyAccount));
+    if (temp || user->currencyAccountNum == 0) {
+        user->currencyAccounts = temp;
+    }
+    return 1;
+}
+
+int findCurrencyAccount(UserAccount *user, int account_id) {
+    for (int i = 0; i < user->currencyAccountNum; i++) {
+        if (user->currencyAccounts[i].account_id == account_id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int exchangeCurrency(ServerDatabase *db, UserAccount *user, int account_index,
+                     int from_currency, int to_currency, Money amount, Money *exchanged_amount) {
+    if (account_index < 1 || account_index > user->currencyAccountNum || amount <= 0) {
+        return 0;
+    }
+    
+    CurrencyAccount *account = &user->currencyAccounts[account_index - 1];
+    
+    // Calculate exchange
+    const char *from_curr_name = getCurrencyName(from_currency);
+    const char *to_curr_name = getCurrencyName(to_currency);
+    
+    // Convert at one consistent rate set; a concurrent publication only
+    // affects conversions that start after it
+    RateReadGuard guard;
+    const RateSet *rates = acquireRates(db, &guard);
+    if (!applyExchangeRates(&rates->table, amount, from_currency, exchanged_amount, to_currency)) {
+        releaseRates(&guard);
+        return 0;
+    }
+    
+    // Update balances, returning the debit if the credit overflows; the
+    // debit itself refuses to overdraw the source currency
+    lockAccount(db, user->client_id, account->account_id);
+    if (updateCurrencyBalance(account, from_currency, -amount, &rates->table)) {
+        if (!updateCurrencyBalance(account, to_currency, *exchanged_amount, &rates->table)) {
+            updateCurrencyBalance(account, from_currency, amount, &rates->table);
+            unlockAccount(db, user->client_id, account->account_id);
+            releaseRates(&guard);
+            return 0;
+        }
+        releaseRates(&guard);
+        
+        // Add transaction to history
+        addTransaction(db, user->client_id, account->account_id, "EXCHANGE", 
+                      from_curr_name, to_curr_name, amount, *exchanged_amount,
+                      fromMinorUnits(to_currency, *exchanged_amount) / fromMinorUnits(from_currency, amount));
+        
+        // Log the mutation
+        WalRecord record = {0};
+        record.type = WAL_EXCHANGE;
+        record.client_id = user->client_id;
+        record.account_id = account->account_id;
+        record.currency_from = from_currency;
+        record.currency_to = to_currency;
+        record.amount_from = amount;
+        record.amount_to = *exchanged_amount;
+        appendWalRecord(db, &record);
+        unlockAccount(db, user->client_id, account->account_id);
+        return 1;
+    }
+    
+    unlockAccount(db, user->client_id, account->account_id);
+    releaseRates(&guard);
+    return 0;
+}
+
+int transferCurrency(ServerDatabase *db, UserAccount *sender, CurrencyAccount *from,
+                     UserAccount *recipient, CurrencyAccount *to, int currency, Money amount) {
+    if (from == to || amount <= 0) return 0;
+    
+    // Hold both accounts so neither is seen mid-transfer; the debit refuses
+    // to overdraw and is returned if the credit would overflow
+    RateReadGuard guard;
+    const ExchangeTable *table = &acquireRates(db, &guard)->table;
+    lockAccountPair(db, sender->client_id, from->account_id, recipient->client_id, to->account_id);
+    if (!updateCurrencyBalance(from, currency, -amount, table)) {
+        unlockAccountPair(db, sender->client_id, from->account_id, recipient->client_id, to->account_id);
+        releaseRates(&guard);
+        return 0;
+    }
+    if (!updateCurrencyBalance(to, currency, amount, table)) {
+        updateCurrencyBalance(from, currency, amount, table);
+        unlockAccountPair(db, sender->client_id, from->account_id, recipient->client_id, to->account_id);
+        releaseRates(&guard);
+        return 0;
+    }
+    releaseRates(&guard);
+    
+    addTransferTransactions(db, sender, from->account_id, recipient, to->account_id, currency, amount);
+    
+    // One record covers both sides, so replay never applies half a transfer
+    WalRecord record = {0};
+    WalTransferTarget target = { recipient->client_id, to->account_id, 0 };
+    record.type = WAL_TRANSFER;
+    record.client_id = sender->client_id;
+    record.account_id = from->account_id;
+    record.currency_from = currency;
+    record.amount_from = amount;
+    memcpy(record.username, &target, sizeof(target));
+    appendWalRecord(db, &record);
+    unlockAccountPair(db, sender->client_id, from->account_id, recipient->client_id, to->account_id);
+    return 1;
+}
+
+int batchTransferCurrency(ServerDatabase *db, UserAccount *sender, CurrencyAccount *from,
+                          BatchTransferItem *items, int count) {
+    // Drop unusable items and total what the source must cover per currency
+    Money totals[CURRENCY_COUNT] = {0};
+    bool stripes[ACCOUNT_LOCK_STRIPES] = {false};
+    addStripeToSet(db, stripes, sender->client_id, from->account_id);
+    int valid = 0;
+    for (int i = 0; i < count; i++) {
+        BatchTransferItem *item = &items[i];
+        item->applied = false;
+        if (item->to == NULL || item->to == from || item->amount <= 0 ||
+            item->currency < 0 || item->currency >= CURRENCY_COUNT) {
+            item->to = NULL;
+            continue;
+        }
+        if (__builtin_add_overflow(totals[item->currency], item->amount, &totals[item->currency])) {
+            return -1;
+        }
+        addStripeToSet(db, stripes, item->recipient->client_id, item->to->account_id);
+        valid++;
+    }
+    if (valid == 0) return 0;
+    
+    WalRecord *records = calloc(valid, sizeof(WalRecord));
+    if (records == NULL) {
+        perror("Failed to allocate batch transfer records");
+        return -1;
+    }
+    
+    // Debit each currency's total at once: the whole batch is checked against
+    // the source balances and nothing moves unless all of it is covered
+    // The source and every recipient stay locked until the batch is logged,
+    // so no later change to any of them can reach the log before it
+    RateReadGuard guard;
+    const ExchangeTable *table = &acquireRates(db, &guard)->table;
+    lockStripeSet(db, stripes);
+    for (int c = 0; c < CURRENCY_COUNT; c++) {
+        if (totals[c] > 0 && !updateCurrencyBalance(from, c, -totals[c], table)) {
+            while (--c >= 0) {
+                if (totals[c] > 0) updateCurrencyBalance(from, c, totals[c], table);
+            }
+            unlockStripeSet(db, stripes);
+            releaseRates(&guard);
+            free(records);
+            return -1;
+        }
+    }
+    
+    // A credit that would overflow its recipient goes back to the source and
+    // is reported unapplied
+    int applied = 0;
+    for (int i = 0; i < count; i++) {
+        BatchTransferItem *item = &items[i];
+        if (item->to == NULL) continue;
+        if (updateCurrencyBalance(item->to, item->currency, item->amount, table)) {
+            item->applied = true;
+            applied++;
+        } else {
+            updateCurrencyBalance(from, item->currency, item->amount, table);
+        }
+    }
+    releaseRates(&guard);
+    
+    if (applied > 0) {
+        addBatchTransferTransactions(db, sender, from->account_id, items, count);
+        
+        // Log the batch as consecutive records in a single commit
+        int logged = 0;
+        for (int i = 0; i < count; i++) {
+            if (!items[i].applied) continue;
+            WalRecord *record = &records[logged++];
+            WalTransferTarget target = { items[i].recipient->client_id, items[i].to->account_id,
+                                         applied - logged };
+            record->type = WAL_TRANSFER;
+            record->client_id = sender->client_id;
+            record->account_id = from->account_id;
+            record->currency_from = items[i].currency;
+            record->amount_from = items[i].amount;
+            memcpy(record->username, &target, sizeof(target));
+        }
+        appendWalRecords(db, records, applied);
+    }
+    unlockStripeSet(db, stripes);
+    free(records);
+    return applied;
+}
+
+// ============================================================
+// Updated Server Database Initialization
+// ============================================================
+
+void initializeServerDatabase(ServerDatabase *db) {
+    db->totalUsers = 0;
+    db->userid = 1;
+    db->userAccountArr = malloc(sizeof(UserAccount));
+    db->usernameIndex = NULL;
+    db->usernameIndexSize = 0;
+    db->wal_sequence = 0;
+    initializeSlabAllocator(&db->transaction_slab, sizeof(Transaction), TRANSACTION_SLAB_SLOTS);
+    db->rates = NULL;
+    db->rate_parity = 0;
+    memset(db->rate_readers, 0, sizeof(db->rate_readers));
+    pthread_mutex_init(&db->rate_update_lock, NULL);
+    Coins rates;
+    initializeExchangeRates(&rates);
+    setExchangeRates(db, &rates);
+    
+    // Prefer writers so a stream of requests cannot starve registrations
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&db->lock, &attr);
+    pthread_rwlock_init(&db->history_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    for (int i = 0; i < ACCOUNT_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&db->account_locks[i].mutex, NULL);
+        db->account_locks[i].sequence = 0;
+    }
+}
+
+// ============================================================
+// Session Scratch Arena and Tokenizer
+// ============================================================
+
+void* arenaAllocate(SessionArena *arena, size_t size) {
+    // Bump allocate from the inline block, keeping pointer alignment
+    size_t align = sizeof(void *) > sizeof(Money) ? sizeof(void *) : sizeof(Money);
+    size = (size + align - 1) / align * align;
+    if (size <= SESSION_ARENA_SIZE - arena->used) {
+        void *memory = arena->block + arena->used;
+        arena->used += size;
+        return memory;
+    }
+    
+    // Larger requests get a heap chunk that lives until the next reset
+    ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + size);
+    if (chunk == NULL) {
+        perror("Failed to grow session arena");
+        return NULL;
+    }
+    chunk->next = arena->overflow;
+    arena->overflow = chunk;
+    return chunk->data;
+}
+
+void arenaReset(SessionArena *arena) {
+    while (arena->overflow != NULL) {
+        ArenaChunk *next = arena->overflow->next;
+        free(arena->overflow);
+        arena->overflow = next;
+    }
+    arena->used = 0;
+}
+
+int tokenizeInput(char *buffer, SessionArena *arena, char ***output) {
+    // Split buffer in place: delimiters become terminators and the returned
+    // NULL-terminated array (taken from the arena) points into buffer
+    *output = NULL;
+    if (buffer == NULL) return 0;
+    
+    int token_count = 0;
+    bool in_token = false;
+    for (char *c = buffer; *c != '\0'; c++) {
+        bool is_delim = strchr(DELIMS, *c) != NULL;
+        if (!is_delim && !in_token) token_count++;
+        in_token = !is_delim;
+    }
+    
+    char **tokens = arenaAllocate(arena, (token_count + 1) * sizeof(char *));
+    if (tokens == NULL) {
+        printf("Tokenization Failed\n");
+        return 0;
+    }
+    
+    int index = 0;
+    in_token = false;
+    for (char *c = buffer; *c != '\0'; c++) {
+        if (strchr(DELIMS, *c) != NULL) {
+            *c = '\0';
+            in_token = false;
+        } else if (!in_token) {
+            tokens[index++] = c;
+            in_token = true;
+        }
+    }
+    tokens[index] = NULL;
+    
+    *output = tokens;
+    printf("Tokenization Successful: %d tokens\n", token_count);
+    return token_count;
+}
+
+// ============================================================
+// Wire Protocol Framing (big-endian, length-prefixed)
+// ============================================================
+
+void encodeFrameHeader(unsigned char *out, const FrameHeader *header) {
+    FrameCursor cursor;
+    frameCursorInit(&cursor, out, FRAME_HEADER_SIZE);
+    framePutU8(&cursor, (uint8_t)header->version);
+    framePutU8(&cursor, (uint8_t)header->opcode);
+    framePutU16(&cursor, (uint16_t)header->status);
+    framePutU32(&cursor, header->request_id);
+    framePutU32(&cursor, (uint32_t)header->length);
+}
+
+void decodeFrameHeader(const unsigned char *in, FrameHeader *header) {
+    FrameCursor cursor;
+    frameCursorInit(&cursor, (unsigned char *)in, FRAME_HEADER_SIZE);
+    header->version = frameGetU8(&cursor);
+    header->opcode = frameGetU8(&cursor);
+    header->status = frameGetU16(&cursor);
+    header->request_id = frameGetU32(&cursor);
+    header->length = frameGetU32(&cursor);
+}
+
+void frameCursorInit(FrameCursor *cursor, void *data, size_t cap) {
+    cursor->data = data;
+    cursor->pos = 0;
+    cursor->cap = cap;
+    cursor->error = false;
+}
+
+// Reserve len bytes at the cursor, or latch the error flag
+static unsigned char* frameAdvance(FrameCursor *cursor, size_t len) {
+    if (cursor->error || len > cursor->cap - cursor->pos) {
+        cursor->error = true;
+        return NULL;
+    }
+    unsigned char *at = cursor->data + cursor->pos;
+    cursor->pos += len;
+    return at;
+}
+
+static void framePutUnsigned(FrameCursor *cursor, uint64_t value, size_t width) {
+    unsigned char *at = frameAdvance(cursor, width);
+    if (at == NULL) return;
+    for (size_t i = 0; i < width; i++) {
+        at[i] = (unsigned char)(value >> (8 * (width - 1 - i)));
+    }
+}
+
+static uint64_t frameGetUnsigned(FrameCursor *cursor, size_t width) {
+    unsigned char *at = frameAdvance(cursor, width);
+    if (at == NULL) return 0;
+    uint64_t value = 0;
+    for (size_t i = 0; i < width; i++) {
+        value = (value << 8) | at[i];
+    }
+    return value;
+}
+
+void framePutU8(FrameCursor *cursor, uint8_t value) { framePutUnsigned(cursor, value, 1); }
+void framePutU16(FrameCursor *cursor, uint16_t value) { framePutUnsigned(cursor, value, 2); }
+void framePutU32(FrameCursor *cursor, uint32_t value) { framePutUnsigned(cursor, value, 4); }
+void framePutI64(FrameCursor *cursor, int64_t value) { framePutUnsigned(cursor, (uint64_t)value, 8); }
+
+void framePutF64(FrameCursor *cursor, double value) {
+    // Doubles travel as their IEEE 754 bit pattern
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    framePutUnsigned(cursor, bits, 8);
+}
+
+void framePutBytes(FrameCursor *cursor, const void *bytes, size_t len) {
+    unsigned char *at = frameAdvance(cursor, len);
+    if (at != NULL && len > 0) memcpy(at, bytes, len);
+}
+
+uint8_t frameGetU8(FrameCursor *cursor) { return (uint8_t)frameGetUnsigned(cursor, 1); }
+uint16_t frameGetU16(FrameCursor *cursor) { return (uint16_t)frameGetUnsigned(cursor, 2); }
+uint32_t frameGetU32(FrameCursor *cursor) { return (uint32_t)frameGetUnsigned(cursor, 4); }
+int64_t frameGetI64(FrameCursor *cursor) { return (int64_t)frameGetUnsigned(cursor, 8); }
+
+double frameGetF64(FrameCursor *cursor) {
+    uint64_t bits = frameGetUnsigned(cursor, 8);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void frameGetBytes(FrameCursor *cursor, void *bytes, size_t len) {
+    unsigned char *at = frameAdvance(cursor, len);
+    if (at != NULL) memcpy(bytes, at, len);
+    else memset(bytes, 0, len);
+}
+
+void framePutAccount(FrameCursor *cursor, const CurrencyAccount *account) {
+    framePutU32(cursor, (uint32_t)account->account_id);
+    framePutU8(cursor, (uint8_t)account->is_shared);
+    for (int c = 0; c < CURRENCY_COUNT; c++) {
+        framePutI64(cursor, __atomic_load_n(&account->coins[c], __ATOMIC_RELAXED));
+    }
+    framePutI64(cursor, account->total_balance);
+}
+
+void frameGetAccount(FrameCursor *cursor, CurrencyAccount *account) {
+    account->account_id = (int)frameGetU32(cursor);
+    account->is_shared = frameGetU8(cursor);
+    for (int c = 0; c < CURRENCY_COUNT; c++) {
+        account->coins[c] = frameGetI64(cursor);
+    }
+    account->total_balance = frameGetI64(cursor);
+}
+
+void framePutTransaction(FrameCursor *cursor, const Transaction *transaction) {
+    // Currencies travel as enum values, 0xFF when the field is unused
+    int from = getCurrencyIndex(transaction->currency_from);
+    int to = getCurrencyIndex(transaction->currency_to);
+    size_t type_len = strlen(transaction->transaction_type);
     
-    if (tokens == NULL) {
-        printf("Tokenization Failed\n");
-    } else {
-        printf("Tokenization Successful: %d tokens\n", token_count);
+    framePutU32(cursor, (uint32_t)transaction->transaction_id);
+    framePutU32(cursor, (uint32_t)transaction->account_id);
+    framePutU8(cursor, (uint8_t)type_len);
+    framePutBytes(cursor, transaction->transaction_type, type_len);
+    framePutU8(cursor, from == -1 ? 0xFF : (uint8_t)from);
+    framePutU8(cursor, to == -1 ? 0xFF : (uint8_t)to);
+    framePutI64(cursor, transaction->amount_from);
+    framePutI64(cursor, transaction->amount_to);
+    framePutF64(cursor, transaction->exchange_rate);
+    framePutI64(cursor, (int64_t)transaction->timestamp);
+    framePutU32(cursor, (uint32_t)transaction->linked_transaction_id);
+}
+
+void frameGetTransaction(FrameCursor *cursor, Transaction *transaction) {
+    memset(transaction, 0, sizeof(Transaction));
+    transaction->transaction_id = (int)frameGetU32(cursor);
+    transaction->account_id = (int)frameGetU32(cursor);
+    
+    size_t type_len = frameGetU8(cursor);
+    if (type_len >= sizeof(transaction->transaction_type)) {
+        cursor->error = true;
+        return;
+    }
+    frameGetBytes(cursor, transaction->transaction_type, type_len);
+    
+    int from = frameGetU8(cursor);
+    int to = frameGetU8(cursor);
+    strcpy(transaction->currency_from, from < CURRENCY_COUNT ? getCurrencyName(from) : "");
+    strcpy(transaction->currency_to, to < CURRENCY_COUNT ? getCurrencyName(to) : "");
+    transaction->amount_from = frameGetI64(cursor);
+    transaction->amount_to = frameGetI64(cursor);
+    transaction->exchange_rate = frameGetF64(cursor);
+    transaction->timestamp = (time_t)frameGetI64(cursor);
+    transaction->linked_transaction_id = (int)frameGetU32(cursor);
+}
+
+int queueRequest(FrameCursor *batch, int opcode, uint32_t request_id, const void *payload, size_t len) {
+    // Append one frame to a batch so several requests can leave in one send
+    if (len > MAX_SIZE - FRAME_HEADER_SIZE) return -1;
+    
+    FrameHeader header = { PROTOCOL_VERSION, opcode, STATUS_OK, request_id, len };
+    size_t start = batch->pos;
+    if (batch->error || FRAME_HEADER_SIZE + len > batch->cap - start) return -1;
+    encodeFrameHeader(batch->data + start, &header);
+    batch->pos += FRAME_HEADER_SIZE;
+    framePutBytes(batch, payload, len);
+    return 0;
+}
+
+int sendFrames(int socket, const void *data, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t bytes_sent = send(socket, (const char *)data + sent, len - sent, MSG_NOSIGNAL);
+        if (bytes_sent == -1 && errno == EINTR) continue;
+        if (bytes_sent <= 0) {
+            perror("Error sending request");
+            return -1;
+        }
+        sent += bytes_sent;
+    }
+    return 0;
+}
+
+int sendRequest(int socket, int opcode, uint32_t request_id, const void *payload, size_t len) {
+    // Header and payload leave in a single send
+    unsigned char frame[MAX_SIZE];
+    FrameCursor batch;
+    frameCursorInit(&batch, frame, sizeof(frame));
+    if (queueRequest(&batch, opcode, request_id, payload, len) == -1) return -1;
+    return sendFrames(socket, frame, batch.pos);
+}
+
+// Read exactly len bytes, however the stream splits them
+static int receiveAll(int socket, void *buffer, size_t len) {
+    size_t received = 0;
+    while (received < len) {
+        ssize_t bytes = recv(socket, (char *)buffer + received, len - received, 0);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) return -1;
+        received += bytes;
+    }
+    return 0;
+}
+
+int receiveResponse(int socket, FrameHeader *header, void *payload, size_t cap) {
+    unsigned char encoded[FRAME_HEADER_SIZE];
+    if (receiveAll(socket, encoded, sizeof(encoded)) == -1) {
+        printf("Connection to server lost\n");
+        return -1;
+    }
+    decodeFrameHeader(encoded, header);
+    if (header->version != PROTOCOL_VERSION || header->length > cap) {
+        printf("Unexpected response frame from server\n");
+        return -1;
     }
+    return receiveAll(socket, payload, header->length);
 }
 
 // ============================================================
-// Enhanced Client Handler with All Operations - MEMORY FIXED
+// Client Session Buffers (non-blocking I/O)
 // ============================================================
 
-void handle_client(int client_socket, int server_socket, ServerDatabase *ServerDatabase){
+ClientSession* createClientSession(int client_socket) {
+    ClientSession *session = calloc(1, sizeof(ClientSession));
+    if (session == NULL) {
+        perror("Failed to allocate client session");
+        return NULL;
+    }
     
-    // Allocate memory for the client account structure
-    UserAccount *clientAccount = malloc(sizeof(UserAccount));
-    clientAccount->password = calloc(50, sizeof(char));
-    clientAccount->username = calloc(50, sizeof(char));
+    session->in_buffer = malloc(MAX_SIZE);
+    if (session->in_buffer == NULL) {
+        perror("Failed to allocate client session");
+        free(session);
+        return NULL;
+    }
+    session->in_cap = MAX_SIZE;
+    session->client_socket = client_socket;
+    session->state = SESSION_AWAIT_FRAME;
+    session->logged_in_user_index = -1;
+    return session;
+}
 
-    // Initialize control variables
-    int input_count = 0;
-    int client_option = 0;
-    int TRUE = 1;
-    int FALSE = 0;
-    bool errorCheck = false;
-    bool isLoggedIn = false;
-    char **tokens = NULL;
-    char handle_client_buffer[MAX_SIZE] = {0};
-    char temp_buffer[MAX_SIZE] = {0}; 
-    ssize_t bytes_received = 0;
-    bool exit = false;
-    int logged_in_user_index = -1;
+void freeClientSession(ClientSession *session) {
+    if (session == NULL) return;
     
-    // Main loop to process client requests until logout or exit
-    while (!exit){
-        printf("\nWaiting to receive user Input\n");
-        fflush(stdout);
+    arenaReset(&session->arena);
+    free(session->in_buffer);
+    free(session->out_buffer);
+    free(session);
+}
 
-        // Receive client request option
-        bytes_received = recv(client_socket, &client_option, sizeof(client_option), 0 );
-        printf("User Request Number %d Received. Input Value: %d\n", input_count, client_option);
-        fflush(stdout);
+unsigned char* sessionReserve(ClientSession *session, size_t len) {
+    // Grow the output buffer geometrically so replies never block the loop;
+    // the reserved bytes are committed by advancing out_len
+    if (session->out_len + len > session->out_cap) {
+        size_t new_cap = session->out_cap > 0 ? session->out_cap : 256;
+        while (new_cap < session->out_len + len) {
+            new_cap *= 2;
+        }
+        
+        char *temp = realloc(session->out_buffer, new_cap);
+        if (temp == NULL) {
+            perror("Failed to grow session output buffer");
+            session->state = SESSION_CLOSED;
+            return NULL;
+        }
+        session->out_buffer = temp;
+        session->out_cap = new_cap;
+    }
+    return (unsigned char *)session->out_buffer + session->out_len;
+}
 
-        if (bytesRecievedCheck(bytes_received)){
+bool beginResponse(ClientSession *session, ResponseBuilder *builder, int opcode, size_t max_payload) {
+    // The payload is encoded straight into the output buffer behind a header
+    // slot that finishResponse fills in once the length is known
+    builder->opcode = opcode;
+    unsigned char *frame = sessionReserve(session, FRAME_HEADER_SIZE + max_payload);
+    if (frame == NULL) {
+        frameCursorInit(&builder->payload, NULL, 0);
+        builder->payload.error = true;
+        return false;
+    }
+    frameCursorInit(&builder->payload, frame + FRAME_HEADER_SIZE, max_payload);
+    return true;
+}
 
-            input_count++;
+void finishResponse(ClientSession *session, ResponseBuilder *builder, int status) {
+    if (builder->payload.data == NULL) return;
+    
+    // A payload that overran its reservation is dropped, not sent truncated
+    if (builder->payload.error) {
+        status = STATUS_FAILED;
+        builder->payload.pos = 0;
+    }
+    FrameHeader header = { PROTOCOL_VERSION, builder->opcode, status,
+                           session->request_id, builder->payload.pos };
+    encodeFrameHeader(builder->payload.data - FRAME_HEADER_SIZE, &header);
+    session->out_len += FRAME_HEADER_SIZE + builder->payload.pos;
+}
 
-            // Handle requests for logged-in clients
-            if (isLoggedIn == true){
-                UserAccount *currentUser = &ServerDatabase->userAccountArr[logged_in_user_index];
-                
-                switch (client_option) {
-                    case 1:
-                        // View client currency accounts
-                        fflush(stdout);
-                        printf("Requested \"View Currency Accounts\"\n");
-                        
-                        // Send number of accounts
-                        send(client_socket, &currentUser->currencyAccountNum, sizeof(currentUser->currencyAccountNum), 0);
-                        
-                        // Send each account details
-                        for (int i = 0; i < currentUser->currencyAccountNum; i++) {
-                            CurrencyAccount *acc = &currentUser->currencyAccounts[i];
-                            send(client_socket, acc, sizeof(CurrencyAccount), 0);
-                        }
-                        break;
+int readClientSession(ClientSession *session) {
+    // Drain the socket until it would block or the input buffer is full
+    while (session->in_len < session->in_cap) {
+        ssize_t bytes_received = recv(session->client_socket,
+                                      session->in_buffer + session->in_len,
+                                      session->in_cap - session->in_len, 0);
+        if (bytes_received > 0) {
+            session->in_len += bytes_received;
+        } else if (bytes_received == 0) {
+            printf("Client disconnected.\n");
+            return 0;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 1;
+        } else {
+            perror("Error receiving data");
+            return 0;
+        }
+    }
+    return 1;
+}
 
-                    case 2:
-                        // Exchange coins between accounts
-                        fflush(stdout);
-                        printf("Requested \"Exchange Coins\"\n");
-                        exchangeCurrency(client_socket, ServerDatabase, currentUser);
-                        break;
+int flushClientSession(ClientSession *session) {
+    while (session->out_sent < session->out_len) {
+        ssize_t bytes_sent = send(session->client_socket,
+                                  session->out_buffer + session->out_sent,
+                                  session->out_len - session->out_sent, MSG_NOSIGNAL);
+        if (bytes_sent > 0) {
+            session->out_sent += bytes_sent;
+        } else if (bytes_sent == -1 && errno == EINTR) {
+            continue;
+        } else if (bytes_sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1; // Still pending, wait for EPOLLOUT
+        } else {
+            perror("Error sending data");
+            return -1;
+        }
+    }
+    
+    session->out_len = 0;
+    session->out_sent = 0;
+    return 0;
+}
+
+// ============================================================
+// Client Handler State Machine
+// ============================================================
 
-                    case 3:
-                        // Withdraw coins from a selected account
-                        fflush(stdout);
-                        printf("Requested \"Withdraw Coins from Account\"\n");
+static void sendStatus(ClientSession *session, int opcode, int status) {
+    ResponseBuilder response;
+    beginResponse(session, &response, opcode, 0);
+    finishResponse(session, &response, status);
+}
 
-                        int w_coin = 0;
-                        int w_accounts = currentUser->currencyAccountNum;
-                        int w_account = 0;
-                        double w_amount = 0;
+// Resolve a 1-based account number from a request
+static CurrencyAccount* requestedAccount(UserAccount *user, uint32_t account_number) {
+    if (account_number < 1 || account_number > (uint32_t)user->currencyAccountNum) {
+        return NULL;
+    }
+    return &user->currencyAccounts[account_number - 1];
+}
 
-                        // If no accounts exist, notify client and abort
-                        if (w_accounts <= 0){
-                            printf("No Coin Accounts Found for Client\n");
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            break;
-                        } else {
-                            // Send number of currency accounts to client
-                            send(client_socket, &w_accounts, sizeof(w_accounts), 0);
-                            printf("Coin Accounts Found, Continuing\n");
-                        }
+static void handleCredentials(ClientSession *session, ServerDatabase *ServerDatabase,
+                              int opcode, FrameCursor *request) {
+    // Credentials arrive as "username\npassword\n"
+    char handle_client_buffer[MAX_SIZE];
+    char **tokens = NULL;
+    size_t copy_len = request->cap < MAX_SIZE ? request->cap : MAX_SIZE - 1;
+    memcpy(handle_client_buffer, request->data, copy_len);
+    handle_client_buffer[copy_len] = '\0';
+    
+    // Tokens are views into handle_client_buffer, so nothing is freed afterwards
+    int token_count = tokenizeInput(handle_client_buffer, &session->arena, &tokens);
+    
+    if (opcode == OP_LOGIN) {
+        printf("Login Data Received\n");
+        if (token_count < 2) {
+            sendStatus(session, opcode, STATUS_BAD_REQUEST);
+            return;
+        }
 
-                        // Receive selected account from client
-                        if ((bytes_received = recv(client_socket, &w_account, sizeof(w_account), 0)) > 0){
-                            printf("Received account: %d\n", w_account);
-                        } else printf("Data Transfer Failure: Account\n");
-
-                        // Send the balances of all coins in the selected account
-                        CurrencyAccount *withdraw_account = &currentUser->currencyAccounts[w_account - 1];
-                        send(client_socket, &(withdraw_account->coins), sizeof(Coins), 0);
-
-                        // Receive coin type and amount for withdrawal
-                        if ((bytes_received = recv(client_socket, &w_coin, sizeof(w_coin), 0)) > 0){
-                            printf("Received coin: %d\n", w_coin);
-                        } else printf("Data Transfer Failure: Coin\n");
-
-                        if ((bytes_received = recv(client_socket, &w_amount, sizeof(w_amount), 0)) > 0){
-                            printf("Received amount: %lf\n", w_amount);
-                        } else printf("Data Transfer Failure: Amount\n");
-
-                        // Withdraw coins based on the selected type
-                        if (updateCurrencyBalance(withdraw_account, w_coin - 1, -w_amount)) {
-                            const char* w_coin_name = getCurrencyName(w_coin - 1);
-                            addTransaction(ServerDatabase, currentUser->client_id, withdraw_account->account_id,
-                                         "WITHDRAW", w_coin_name, "", w_amount, 0, 0);
-                            saveServerDatabaseToFile(ServerDatabase, DATABASE_FILE);
-                            printf("Funds Withdrawn Successfully: %lf %s\n", w_amount, w_coin_name);
-                            send(client_socket, &TRUE, sizeof(TRUE), 0);
-                        } else {
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            printf("Withdrawal Failed - Insufficient funds\n");
-                        }
-                        break;
+        printf("Username: %s\n", tokens[0]);
 
-                    case 4:
-                        // Deposit coins into an account
-                        fflush(stdout);
-                        printf("Requested \"Deposit Coins to Account\"\n");
+        // Authenticate user
+        session->logged_in_user_index = authenticateUser(ServerDatabase, tokens[0], tokens[1]);
+        
+        if (session->logged_in_user_index != -1) {
+            sendStatus(session, opcode, STATUS_OK);
+            session->isLoggedIn = true;
+            printf("Client Logged in successfully.\n");
+        } else {
+            sendStatus(session, opcode, STATUS_FAILED);
+            session->isLoggedIn = false;
+            printf("Client failed to log in. Incorrect credentials\n");
+        }
+    } else {
+        if (token_count < 2) {
+            sendStatus(session, opcode, STATUS_BAD_REQUEST);
+        } else if (createNewUser(ServerDatabase, tokens[0], tokens[1])) {
+            // Log the new user
+            WalRecord record = {0};
+            record.type = WAL_CREATE_USER;
+            record.client_id = ServerDatabase->userid - 1;
+            strcpy(record.username, tokens[0]);
+            strcpy(record.password, tokens[1]);
+            appendWalRecord(ServerDatabase, &record);
+            sendStatus(session, opcode, STATUS_OK);
+            printf("Account Creation Successful\n");
+        } else {
+            sendStatus(session, opcode, STATUS_FAILED);
+            printf("Account Creation FAILED - Username may already exist\n");
+        }
+    }
+}
 
-                        int d_coin = 0;
-                        int d_accounts = currentUser->currencyAccountNum;
-                        int d_account = 0;
-                        double d_amount = 0;
+_Static_assert(4 + (CONVERT_BATCH_MAX_ITEMS + 7) / 8 + CONVERT_BATCH_MAX_ITEMS * 8 <= FRAME_MAX_PAYLOAD,
+               "a full batch conversion reply must fit one client frame");
 
-                        // If no accounts exist, notify client and abort
-                        if (d_accounts <= 0){
-                            printf("No Coin Accounts Found for Client\n");
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            break;
-                        } else {
-                            // Send number of accounts to client
-                            send(client_socket, &d_accounts, sizeof(d_accounts), 0);
-                            printf("Coin Accounts Found, Continuing\n");
-                        }
+static void handleLoggedInRequest(ClientSession *session, ServerDatabase *ServerDatabase,
+                                  int opcode, FrameCursor *request) {
+    UserAccount *currentUser = &ServerDatabase->userAccountArr[session->logged_in_user_index];
+    
+    switch (opcode) {
+        case OP_VIEW_ACCOUNTS: {
+            // Send number of accounts followed by each account's details.
+            // A database from before the account limit may hold more than
+            // a client accepts in one reply; those views are refused.
+            printf("Requested \"View Currency Accounts\"\n");
+            if (currentUser->currencyAccountNum > VIEW_ACCOUNTS_MAX) {
+                sendStatus(session, opcode, STATUS_FAILED);
+                printf("View Failed - %d accounts do not fit one reply\n", currentUser->currencyAccountNum);
+                break;
+            }
+            ResponseBuilder response;
+            beginResponse(session, &response, opcode,
+                          4 + (size_t)currentUser->currencyAccountNum * FRAME_ACCOUNT_SIZE);
+            framePutU32(&response.payload, (uint32_t)currentUser->currencyAccountNum);
+            for (int i = 0; i < currentUser->currencyAccountNum; i++) {
+                CurrencyAccount account;
+                readAccount(ServerDatabase, currentUser->client_id, &currentUser->currencyAccounts[i], &account);
+                framePutAccount(&response.payload, &account);
+            }
+            finishResponse(session, &response, STATUS_OK);
+            break;
+        }
 
-                        // Receive account, coin type, and amount from client
-                        if ((bytes_received = recv(client_socket, &d_account, sizeof(d_account), 0)) > 0){
-                            printf("Received account: %d\n", d_account);
-                        } else printf("Data Transfer Failure: Account\n");
+        case OP_GET_RATES: {
+            // Current exchange rates to Euro
+            ResponseBuilder response;
+            beginResponse(session, &response, opcode, CURRENCY_COUNT * 8);
+            RateReadGuard guard;
+            const RateSet *rates = acquireRates(ServerDatabase, &guard);
+            for (int c = 0; c < CURRENCY_COUNT; c++) {
+                framePutF64(&response.payload, rates->rates.rate[c]);
+            }
+            releaseRates(&guard);
+            finishResponse(session, &response, STATUS_OK);
+            break;
+        }
 
-                        if ((bytes_received = recv(client_socket, &d_coin, sizeof(d_coin), 0)) > 0){
-                            printf("Received coin: %d\n", d_coin);
-                        } else printf("Data Transfer Failure: Coin\n");
+        case OP_CONVERT_BATCH: {
+            // Item count, then per item source currency, target currency and
+            // amount in source minor units. Replies with the number converted,
+            // a bitmap of converted items and every result, all at one rate set.
+            uint32_t count = frameGetU32(request);
+            if (request->error || count == 0 || count > CONVERT_BATCH_MAX_ITEMS) {
+                sendStatus(session, opcode, STATUS_BAD_REQUEST);
+                break;
+            }
+            // Decoded into separate arrays so the conversion loop runs over contiguous columns
+            Money *amounts = arenaAllocate(&session->arena, count * (2 * sizeof(Money) + 3));
+            if (amounts == NULL) {
+                sendStatus(session, opcode, STATUS_FAILED);
+                break;
+            }
+            Money *results = amounts + count;
+            uint8_t *from = (uint8_t *)(results + count);
+            uint8_t *to = from + count;
+            uint8_t *converted = to + count;
+            for (uint32_t i = 0; i < count; i++) {
+                from[i] = frameGetU8(request);
+                to[i] = frameGetU8(request);
+                amounts[i] = frameGetI64(request);
+            }
+            if (request->error) {
+                sendStatus(session, opcode, STATUS_BAD_REQUEST);
+                break;
+            }
 
-                        if ((bytes_received = recv(client_socket, &d_amount, sizeof(d_amount), 0)) > 0){
-                            printf("Received amount: %lf\n", d_amount);
-                        } else printf("Data Transfer Failure: Amount\n");
+            RateReadGuard guard;
+            const RateSet *rates = acquireRates(ServerDatabase, &guard);
+            size_t total = convertCurrencyBatch(&rates->table, from, to, amounts, results, converted, count);
+            releaseRates(&guard);
+
+            ResponseBuilder response;
+            beginResponse(session, &response, opcode, 4 + (count + 7) / 8 + (size_t)count * 8);
+            framePutU32(&response.payload, (uint32_t)total);
+            for (uint32_t i = 0; i < count; i += 8) {
+                uint8_t bits = 0;
+                for (uint32_t k = 0; k < 8 && i + k < count; k++) {
+                    if (converted[i + k]) bits |= (uint8_t)(1u << k);
+                }
+                framePutU8(&response.payload, bits);
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                framePutI64(&response.payload, results[i]);
+            }
+            finishResponse(session, &response, STATUS_OK);
+            break;
+        }
 
-                        CurrencyAccount *deposit_account = &currentUser->currencyAccounts[d_account - 1];
-                        
-                        if (updateCurrencyBalance(deposit_account, d_coin - 1, d_amount)) {
-                            const char* coin_name = getCurrencyName(d_coin - 1);
-                            addTransaction(ServerDatabase, currentUser->client_id, deposit_account->account_id,
-                                         "DEPOSIT", coin_name, "", d_amount, 0, 0);
-                            saveServerDatabaseToFile(ServerDatabase, DATABASE_FILE);
-                            printf("Funds Added Successfully: %lf %s\n", d_amount, coin_name);
-                            send(client_socket, &TRUE, sizeof(TRUE), 0);
-                        } else {
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            printf("Deposit Failed\n");
-                        }
-                        break;
+        case OP_SET_RATES: {
+            // Rate to Euro of every currency, in enum order
+            printf("Requested \"Set Exchange Rates\"\n");
+            Coins rates;
+            for (int c = 0; c < CURRENCY_COUNT; c++) {
+                rates.rate[c] = frameGetF64(request);
+            }
+            if (request->error) {
+                sendStatus(session, opcode, STATUS_BAD_REQUEST);
+            } else if (admin_username == NULL || strcmp(currentUser->username, admin_username) != 0) {
+                sendStatus(session, opcode, STATUS_FORBIDDEN);
+            } else {
+                sendStatus(session, opcode, publishExchangeRates(ServerDatabase, &rates) ? STATUS_OK : STATUS_FAILED);
+            }
+            break;
+        }
 
-                    case 5:
-                        // Create a new currency account for the client
-                        fflush(stdout);
-                        printf("Requested \"Create Coin Account\"\n");
+        case OP_GET_TOTALS: {
+            // Amount of every currency held across all accounts, in enum order
+            if (admin_username == NULL || strcmp(currentUser->username, admin_username) != 0) {
+                sendStatus(session, opcode, STATUS_FORBIDDEN);
+                break;
+            }
+            Money totals[CURRENCY_COUNT];
+            readCurrencyTotals(totals);
+            ResponseBuilder response;
+            beginResponse(session, &response, opcode, CURRENCY_COUNT * 8);
+            for (int c = 0; c < CURRENCY_COUNT; c++) {
+                framePutI64(&response.payload, totals[c]);
+            }
+            finishResponse(session, &response, STATUS_OK);
+            break;
+        }
 
-                        int initDepo = 0;
-                        int isShared = 0;
+        case OP_EXCHANGE: {
+            // Account, source currency, target currency and amount in source minor units
+            printf("Requested \"Exchange Coins\"\n");
+            uint32_t account_number = frameGetU32(request);
+            int from_currency = frameGetU8(request);
+            int to_currency = frameGetU8(request);
+            Money amount = frameGetI64(request);
+            if (request->error) {
+                sendStatus(session, opcode, STATUS_BAD_REQUEST);
+                break;
+            }
+            
+            Money exchanged_amount = 0;
+            if (exchangeCurrency(ServerDatabase, currentUser, (int)account_number,
+                                 from_currency, to_currency, amount, &exchanged_amount)) {
+                ResponseBuilder response;
+                beginResponse(session, &response, opcode, 8);
+                framePutI64(&response.payload, exchanged_amount);
+                finishResponse(session, &response, STATUS_OK);
+            } else {
+                sendStatus(session, opcode, STATUS_FAILED);
+            }
+            break;
+        }
 
-                        // Receive initial deposit
-                        if (recv(client_socket, &initDepo, sizeof(initDepo), 0) <= 0) {
-                            perror("Failed to receive initial deposit");
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            break;
-                        }
-                        printf("Initial Deposit Received: %d\n", initDepo);
+        case OP_WITHDRAW:
+        case OP_DEPOSIT: {
+            // Account, coin type and amount in that coin's minor units
+            bool deposit = opcode == OP_DEPOSIT;
+            printf("Requested \"%s Coins\"\n", deposit ? "Deposit" : "Withdraw");
+            uint32_t account_number = frameGetU32(request);
+            int coin = frameGetU8(request);
+            Money amount = frameGetI64(request);
+            if (request->error || amount <= 0) {
+                sendStatus(session, opcode, STATUS_BAD_REQUEST);
+                break;
+            }
+            printf("Received account: %u\nReceived coin: %d\nReceived amount: %.2f\n",
+                   account_number, coin, fromMinorUnits(coin, amount));
+            
+            CurrencyAccount *account = requestedAccount(currentUser, account_number);
+            if (account == NULL) {
+                sendStatus(session, opcode, STATUS_FAILED);
+                printf("%s Failed - Invalid account\n", deposit ? "Deposit" : "Withdrawal");
+                break;
+            }
+            
+            // Keep the account locked until the change is logged, so a later
+            // change to it can never reach the log first
+            RateReadGuard guard;
+            const RateSet *rates = acquireRates(ServerDatabase, &guard);
+            lockAccount(ServerDatabase, currentUser->client_id, account->account_id);
+            int updated = updateCurrencyBalance(account, coin, deposit ? amount : -amount, &rates->table);
+            releaseRates(&guard);
+            if (updated) {
+                const char* coin_name = getCurrencyName(coin);
+                addTransaction(ServerDatabase, currentUser->client_id, account->account_id,
+                             deposit ? "DEPOSIT" : "WITHDRAW", coin_name, "", amount, 0, 0);
+                
+                WalRecord record = {0};
+                record.type = deposit ? WAL_DEPOSIT : WAL_WITHDRAW;
+                record.client_id = currentUser->client_id;
+                record.account_id = account->account_id;
+                record.currency_from = coin;
+                record.amount_from = amount;
+                appendWalRecord(ServerDatabase, &record);
+                unlockAccount(ServerDatabase, currentUser->client_id, account->account_id);
+                printf("Funds %s Successfully: %.2f %s\n", deposit ? "Added" : "Withdrawn",
+                       fromMinorUnits(coin, amount), coin_name);
+                sendStatus(session, opcode, STATUS_OK);
+            } else {
+                unlockAccount(ServerDatabase, currentUser->client_id, account->account_id);
+                sendStatus(session, opcode, STATUS_FAILED);
+                printf("%s Failed - Insufficient funds\n", deposit ? "Deposit" : "Withdrawal");
+            }
+            break;
+        }
 
-                        // Receive shared account flag
-                        if (recv(client_socket, &isShared, sizeof(isShared), 0) <= 0) {
-                            perror("Failed to receive isShared status");
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            break;
-                        }
-                        printf("isShared Received: %d\n", isShared);
-
-                        // Reallocate memory for new account and initialize it
-                        CurrencyAccount *temp = realloc(currentUser->currencyAccounts,
-                                                        (currentUser->currencyAccountNum + 1) * sizeof(CurrencyAccount));
-                        if (temp == NULL) {
-                            perror("Failed to allocate memory for a new currency account\n");
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            break;
-                        }
-                        currentUser->currencyAccounts = temp;
+        case OP_CREATE_ACCOUNT: {
+            // Initial deposit in Euro cents and shared account flag
+            printf("Requested \"Create Coin Account\"\n");
+            Money initial_deposit = frameGetI64(request);
+            int is_shared = frameGetU8(request);
+            if (request->error || initial_deposit < 0 || is_shared > 1) {
+                sendStatus(session, opcode, STATUS_BAD_REQUEST);
+                break;
+            }
+            printf("Initial Deposit Received: %.2f\nisShared Received: %d\n",
+                   fromMinorUnits(CURRENCY_EURO, initial_deposit), is_shared);
+            
+            // Stop at as many accounts as one view reply carries
+            if (currentUser->currencyAccountNum >= VIEW_ACCOUNTS_MAX) {
+                sendStatus(session, opcode, STATUS_FAILED);
+                printf("Account Creation Failed - Account limit reached\n");
+                break;
+            }
+            CurrencyAccount *account = createCurrencyAccount(currentUser, initial_deposit, is_shared);
+            if (account == NULL) {
+                sendStatus(session, opcode, STATUS_FAILED);
+                break;
+            }
+            
+            // Add transaction and log the new account
+            addTransaction(ServerDatabase, currentUser->client_id, account->account_id,
+                          "CREATE_ACCOUNT", "Euro", "", initial_deposit, 0, 0);
+            
+            WalRecord record = {0};
+            record.type = WAL_CREATE_ACCOUNT;
+            record.client_id = currentUser->client_id;
+            record.account_id = account->account_id;
+            record.is_shared = is_shared;
+            record.amount_from = initial_deposit;
+            appendWalRecord(ServerDatabase, &record);
+
+            printf("Account Creation Successful. Initial Deposit: %.2f\n",
+                   fromMinorUnits(CURRENCY_EURO, account->coins[CURRENCY_EURO]));
+            sendStatus(session, opcode, STATUS_OK);
+            break;
+        }
 
-                        int newAccountIndex = currentUser->currencyAccountNum;
-                        memset(&currentUser->currencyAccounts[newAccountIndex], 0, sizeof(CurrencyAccount));
-                        currentUser->currencyAccounts[newAccountIndex].coins.Euro = initDepo;
-                        currentUser->currencyAccounts[newAccountIndex].is_shared = isShared;
-                        currentUser->currencyAccounts[newAccountIndex].account_id = currentUser->coin_account_id_counter++;
+        case OP_DELETE_ACCOUNT: {
+            printf("Requested \"Delete Coin Account\"\n");
+            uint32_t account_number = frameGetU32(request);
+            CurrencyAccount *account = requestedAccount(currentUser, account_number);
+            if (request->error || account == NULL) {
+                sendStatus(session, opcode, STATUS_FAILED);
+                break;
+            }
+            
+            int account_id = account->account_id;
+            if (!deleteCurrencyAccount(currentUser, (int)account_number)) {
+                sendStatus(session, opcode, STATUS_FAILED);
+                break;
+            }
+            
+            WalRecord record = {0};
+            record.type = WAL_DELETE_ACCOUNT;
+            record.client_id = currentUser->client_id;
+            record.account_id = account_id;
+            appendWalRecord(ServerDatabase, &record);
+            sendStatus(session, opcode, STATUS_OK);
+            break;
+        }
 
-                        currentUser->currencyAccountNum++;
-                        
-                        // Add transaction
-                        addTransaction(ServerDatabase, currentUser->client_id, 
-                                      currentUser->currencyAccounts[newAccountIndex].account_id,
-                                      "CREATE_ACCOUNT", "Euro", "", initDepo, 0, 0);
-                        
-                        // Save database
-                        saveServerDatabaseToFile(ServerDatabase, DATABASE_FILE);
+        case OP_HISTORY: {
+            // Resume cursor and page size; the page is sent newest first,
+            // followed by the cursor for the next older page
+            printf("Requested \"Transaction History\"\n");
+            long cursor = (long)frameGetI64(request);
+            int limit = (int)frameGetU32(request);
+            if (request->error) {
+                sendStatus(session, opcode, STATUS_BAD_REQUEST);
+                break;
+            }
+            
+            // Pages are only read, so history requests share the lock
+            pthread_rwlock_rdlock(&ServerDatabase->history_lock);
+            int first;
+            int count = getTransactionHistoryPage(currentUser, cursor, limit, &first);
+            ResponseBuilder response;
+            beginResponse(session, &response, opcode,
+                          4 + (size_t)count * FRAME_TRANSACTION_MAX_SIZE + 8);
+            framePutU32(&response.payload, (uint32_t)count);
+            for (int i = first + count - 1; i >= first; i--) {
+                framePutTransaction(&response.payload, currentUser->history[i]);
+            }
+            framePutI64(&response.payload, first);
+            pthread_rwlock_unlock(&ServerDatabase->history_lock);
+            finishResponse(session, &response, STATUS_OK);
+            break;
+        }
 
-                        printf("Account Creation Successful. Initial Deposit: %lf\n", currentUser->currencyAccounts[newAccountIndex].coins.Euro);
-                        send(client_socket, &TRUE, sizeof(TRUE), 0);
-                        break;
+        case OP_LOGOUT:
+            // Logout and exit
+            printf("Requested \"Logout & Exit\"\n");
+            session->isLoggedIn = false;
+            session->logged_in_user_index = -1;
+            session->state = SESSION_CLOSED;
+            break;
 
-                    case 6:
-                        // Delete a currency account
-                        fflush(stdout);
-                        printf("Requested \"Delete Coin Account\"\n");
-                        
-                        int del_account = 0;
-                        int total_accounts = currentUser->currencyAccountNum;
-                        
-                        send(client_socket, &total_accounts, sizeof(total_accounts), 0);
-                        
-                        if (recv(client_socket, &del_account, sizeof(del_account), 0) <= 0) {
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            break;
-                        }
-                        
-                        if (del_account < 1 || del_account > total_accounts) {
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            break;
-                        }
-                        
-                        // Shift accounts array
-                        for (int i = del_account - 1; i < total_accounts - 1; i++) {
-                            currentUser->currencyAccounts[i] = currentUser->currencyAccounts[i + 1];
-                        }
-                        
-                        currentUser->currencyAccountNum--;
-                        
-                        // Reallocate to smaller size
-                        temp = realloc(currentUser->currencyAccounts, 
-                                      currentUser->currencyAccountNum * sizeof(CurrencyAccount));
-                        if (temp || currentUser->currencyAccountNum == 0) {
-                            currentUser->currencyAccounts = temp;
-                        }
-                        
-                        saveServerDatabaseToFile(ServerDatabase, DATABASE_FILE);
-                        send(client_socket, &TRUE, sizeof(TRUE), 0);
-                        break;
+        case OP_TRANSFER: {
+            // Source account, coin type, amount in that coin's minor units,
+            // then the recipient's account id and username
+            printf("Requested \"Send Coins\"\n");
+            uint32_t account_number = frameGetU32(request);
+            int coin = frameGetU8(request);
+            Money amount = frameGetI64(request);
+            int recipient_account_id = (int)frameGetU32(request);
+            size_t name_len = frameGetU8(request);
+            char recipient_name[CREDENTIAL_SIZE];
+            if (name_len >= sizeof(recipient_name)) request->error = true;
+            else frameGetBytes(request, recipient_name, name_len);
+            if (request->error || amount <= 0 || coin >= CURRENCY_COUNT) {
+                sendStatus(session, opcode, STATUS_BAD_REQUEST);
+                break;
+            }
+            recipient_name[name_len] = '\0';
+            
+            CurrencyAccount *from = requestedAccount(currentUser, account_number);
+            int recipient_index = findUserByUsername(ServerDatabase, recipient_name);
+            UserAccount *recipient = recipient_index != -1 ? &ServerDatabase->userAccountArr[recipient_index] : NULL;
+            int to_index = recipient != NULL ? findCurrencyAccount(recipient, recipient_account_id) : -1;
+            if (from == NULL || to_index == -1) {
+                sendStatus(session, opcode, STATUS_FAILED);
+                printf("Transfer Failed - Invalid account\n");
+                break;
+            }
+            
+            if (transferCurrency(ServerDatabase, currentUser, from, recipient,
+                                 &recipient->currencyAccounts[to_index], coin, amount)) {
+                printf("Transferred %.2f %s to %s\n", fromMinorUnits(coin, amount),
+                       getCurrencyName(coin), recipient_name);
+                sendStatus(session, opcode, STATUS_OK);
+            } else {
+                sendStatus(session, opcode, STATUS_FAILED);
+                printf("Transfer Failed - Insufficient funds\n");
+            }
+            break;
+        }
 
-                    case 7:
-                        // Send or request coins
-                        fflush(stdout);
-                        printf("Requested \"Send or Request Coins\"\n");
-                        send(client_socket, &FALSE, sizeof(FALSE), 0); // Not implemented yet
-                        break;
+        case OP_BATCH_TRANSFER: {
+            // Source account and item count, then per item the recipient's
+            // username (length-prefixed), account id, coin and amount.
+            // Replies with the number applied and a bitmap of applied items.
+            printf("Requested \"Batch Transfer\"\n");
+            uint32_t account_number = frameGetU32(request);
+            uint32_t count = frameGetU32(request);
+            if (request->error || count == 0 || count > BATCH_TRANSFER_MAX_ITEMS) {
+                sendStatus(session, opcode, STATUS_BAD_REQUEST);
+                break;
+            }
+            BatchTransferItem *items = arenaAllocate(&session->arena, count * sizeof(BatchTransferItem));
+            if (items == NULL) {
+                sendStatus(session, opcode, STATUS_FAILED);
+                break;
+            }
+            for (uint32_t i = 0; i < count && !request->error; i++) {
+                size_t name_len = frameGetU8(request);
+                char recipient_name[CREDENTIAL_SIZE];
+                if (name_len >= sizeof(recipient_name)) request->error = true;
+                else frameGetBytes(request, recipient_name, name_len);
+                recipient_name[request->error ? 0 : name_len] = '\0';
+                int recipient_account_id = (int)frameGetU32(request);
+                items[i].currency = frameGetU8(request);
+                items[i].amount = frameGetI64(request);
+                
+                // Unknown recipients stay in the batch as unapplied items
+                int recipient_index = findUserByUsername(ServerDatabase, recipient_name);
+                items[i].recipient = recipient_index != -1 ? &ServerDatabase->userAccountArr[recipient_index] : NULL;
+                int to_index = items[i].recipient != NULL ?
+                               findCurrencyAccount(items[i].recipient, recipient_account_id) : -1;
+                items[i].to = to_index != -1 ? &items[i].recipient->currencyAccounts[to_index] : NULL;
+            }
+            if (request->error) {
+                sendStatus(session, opcode, STATUS_BAD_REQUEST);
+                break;
+            }
+            
+            CurrencyAccount *from = requestedAccount(currentUser, account_number);
+            int applied = from != NULL ? batchTransferCurrency(ServerDatabase, currentUser, from, items, (int)count) : -1;
+            if (applied < 0) {
+                sendStatus(session, opcode, STATUS_FAILED);
+                printf("Batch Transfer Failed - Invalid account or insufficient funds\n");
+                break;
+            }
+            
+            ResponseBuilder response;
+            beginResponse(session, &response, opcode, 4 + (count + 7) / 8);
+            framePutU32(&response.payload, (uint32_t)applied);
+            for (uint32_t i = 0; i < count; i += 8) {
+                uint8_t bits = 0;
+                for (uint32_t k = 0; k < 8 && i + k < count; k++) {
+                    if (items[i + k].applied) bits |= (uint8_t)(1u << k);
+                }
+                framePutU8(&response.payload, bits);
+            }
+            finishResponse(session, &response, STATUS_OK);
+            printf("Batch Transfer applied %d of %u payments\n", applied, count);
+            break;
+        }
 
-                    case 8:
-                        // Transaction history
-                        fflush(stdout);
-                        printf("Requested \"Transaction History\"\n");
-                        printTransactionHistory(client_socket, ServerDatabase, currentUser->client_id);
-                        break;
-                    
-                    case 9:
-                        // Logout and exit
-                        fflush(stdout);
-                        printf("Requested \"Logout & Exit\"\n");
-                        isLoggedIn = false;
-                        logged_in_user_index = -1;
-                        exit = true;
-                        break;
+        case OP_DELETE_USER:
+            // Deleting the user is not implemented yet
+            sendStatus(session, opcode, STATUS_UNSUPPORTED);
+            break;
+
+        default:
+            sendStatus(session, opcode, STATUS_BAD_REQUEST);
+            break;
+    }
+}
 
-                    case 10:
-                        // Delete user account
-                        fflush(stdout);
-                        printf("Requested \"Delete My Account\"\n");
-                        send(client_socket, &FALSE, sizeof(FALSE), 0); // Not implemented yet
-                        break;
+static size_t processClientInput(ClientSession *session, ServerDatabase *ServerDatabase) {
+    // Wait for a complete frame: header first, then its payload.
+    // The version byte is checked first so older clients, whose headers
+    // are shorter, are turned away instead of left waiting.
+    if (session->state == SESSION_CLOSED || session->in_len == 0) return 0;
+    
+    FrameHeader header = {0};
+    int version = (unsigned char)session->in_buffer[0];
+    if (version == PROTOCOL_VERSION) {
+        if (session->in_len < FRAME_HEADER_SIZE) return 0;
+        decodeFrameHeader((unsigned char *)session->in_buffer, &header);
+    }
+    session->request_id = header.request_id;
+    if (version != PROTOCOL_VERSION ||
+        header.length > FRAME_MAX_REQUEST - FRAME_HEADER_SIZE) {
+        // The stream cannot be resynchronised, so answer once and hang up
+        printf("Rejected frame (version %d, %zu bytes) from client %d\n",
+               version, header.length, session->client_socket);
+        sendStatus(session, header.opcode,
+                   version != PROTOCOL_VERSION ? STATUS_UNSUPPORTED : STATUS_BAD_REQUEST);
+        session->state = SESSION_CLOSED;
+        return session->in_len;
+    }
+    size_t frame_len = FRAME_HEADER_SIZE + header.length;
+    if (frame_len > session->in_cap) {
+        // Make room for a large request; handle_client shrinks it back afterwards
+        char *temp = realloc(session->in_buffer, frame_len);
+        if (temp == NULL) {
+            perror("Failed to grow session input");
+            sendStatus(session, header.opcode, STATUS_FAILED);
+            session->state = SESSION_CLOSED;
+            return session->in_len;
+        }
+        session->in_buffer = temp;
+        session->in_cap = frame_len;
+    }
+    if (session->in_len < frame_len) return 0;
+    
+    FrameCursor request;
+    frameCursorInit(&request, session->in_buffer + FRAME_HEADER_SIZE, header.length);
+    printf("User Request Number %d Received. Opcode: %d, Request ID: %u\n",
+           session->input_count, header.opcode, header.request_id);
+    session->input_count++;
+    
+    // Requests that reshape the user table or an account array run alone;
+    // everything else shares the database and locks the accounts it touches
+    bool exclusive = header.opcode == OP_REGISTER || header.opcode == OP_CREATE_ACCOUNT ||
+                     header.opcode == OP_DELETE_ACCOUNT;
+    if (exclusive) {
+        pthread_rwlock_wrlock(&ServerDatabase->lock);
+    } else {
+        pthread_rwlock_rdlock(&ServerDatabase->lock);
+    }
+    
+    switch (header.opcode) {
+        case OP_LOGIN:
+        case OP_REGISTER:
+            if (session->isLoggedIn) {
+                sendStatus(session, header.opcode, STATUS_BAD_REQUEST);
+            } else {
+                handleCredentials(session, ServerDatabase, header.opcode, &request);
+            }
+            break;
 
-                    default:
-                        // Unexpected request
-                        printf("(Logged-in) Unexpected Error. Client Unresponsive: %d\n", client_socket);
-                        exit = true;
-                        break;
-                }
+        case OP_QUIT:
+            // Exit request
+            printf("Requested \"Exit\". Exiting.\n");
+            session->state = SESSION_CLOSED;
+            break;
+
+        default:
+            if (!session->isLoggedIn) {
+                sendStatus(session, header.opcode, STATUS_NOT_LOGGED_IN);
             } else {
-                // Handle requests for non-logged-in clients (login, create account, exit)
-                switch (client_option) {
-                    case 1:
-                        // Login request
-                        fflush(stdout);
-                        printf("Requested \"Login\"\n");
-
-                        tokens = NULL;
-                        clearBuffer(handle_client_buffer);
-                        recv(client_socket, handle_client_buffer, sizeof(handle_client_buffer), 0);
-
-                        // Confirm data received
-                        if (handle_client_buffer[0] != '\0'){
-                            send(client_socket, &TRUE, sizeof(TRUE), 0);
-                            printf("Login Data Received\n");
-                        }else{
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            printf("Data transfer FAILED\n");
-                            break;
-                        }
+                handleLoggedInRequest(session, ServerDatabase, header.opcode, &request);
+            }
+            break;
+    }
+    pthread_rwlock_unlock(&ServerDatabase->lock);
+    return frame_len;
+}
 
-                        tokenizeInput(handle_client_buffer, &tokens);
-                        if (tokens == NULL || tokens[0] == NULL || tokens[1] == NULL) {
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            break;
-                        }
+void handle_client(ClientSession *session, ServerDatabase *ServerDatabase) {
+    // Run every protocol step that is fully buffered, keep the remainder.
+    // Each step takes the database locks it needs (see processClientInput).
+    size_t consumed;
+    do {
+        long logged_before = walAppendedByThread();
+        consumed = processClientInput(session, ServerDatabase);
+        arenaReset(&session->arena);
+        if (walAppendedByThread() != logged_before) {
+            // Replies queued from here on wait until this mutation is durable
+            session->commit_sequence = walAppendedByThread();
+        }
+        if (consumed > 0) {
+            session->in_len -= consumed;
+            memmove(session->in_buffer, session->in_buffer + consumed, session->in_len);
+        }
+    } while (consumed > 0 && session->state != SESSION_CLOSED);
+    
+    // Give back the room a large request needed once it has been handled
+    // (a buffered header may already announce the next large frame)
+    if (session->in_cap > MAX_SIZE && session->in_len < FRAME_HEADER_SIZE) {
+        char *temp = realloc(session->in_buffer, MAX_SIZE);
+        if (temp != NULL) {
+            session->in_buffer = temp;
+            session->in_cap = MAX_SIZE;
+        }
+    }
+    fflush(stdout);
+}
 
-                        printf("Username: %s\n", tokens[0]);
-                        printf("Password: %s\n", tokens[1]);
+// ============================================================
+// Client Operations Function
+// ============================================================
 
-                        // Authenticate user
-                        logged_in_user_index = authenticateUser(ServerDatabase, tokens[0], tokens[1]);
-                        
-                        if (logged_in_user_index != -1){
-                            send(client_socket, &TRUE, sizeof(TRUE), 0);
-                            send(client_socket, &TRUE, sizeof(TRUE), 0);
-                            isLoggedIn = true;
-                            
-                            // Copy user data to clientAccount for backward compatibility
-                            strcpy(clientAccount->username, tokens[0]);
-                            strcpy(clientAccount->password, tokens[1]);
-                            clientAccount->client_id = ServerDatabase->userAccountArr[logged_in_user_index].client_id;
-                            clientAccount->currencyAccountNum = ServerDatabase->userAccountArr[logged_in_user_index].currencyAccountNum;
-                            
-                            printf("Client Logged in successfully.\n");
-                        } else {
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            send(client_socket, &FALSE, sizeof(FALSE), 0);
-                            isLoggedIn = false;
-                            printf("Client failed to log in. Incorrect credentials\n");
-                        }
-                        
-                        // Free tokens safely - FIXED
-                        freeTokens(&tokens);
-                        break;
+// Tag for the next request this client sends
+static uint32_t next_request_id = 1;
 
-                    case 2:
-                        // Account creation request
-                        fflush(stdout);
-                        printf("Requested \"Account Creation\"\n");
+// Receive the response tagged request_id into response; returns its status or -1
+static int receiveTagged(int client_socket, uint32_t request_id,
+                         unsigned char *response, size_t response_cap, FrameCursor *cursor) {
+    FrameHeader header;
+    if (receiveResponse(client_socket, &header, response, response_cap) == -1) {
+        return -1;
+    }
+    if (header.request_id != request_id) {
+        printf("Response %u does not match request %u\n", header.request_id, request_id);
+        return -1;
+    }
+    if (cursor != NULL) {
+        frameCursorInit(cursor, response, header.length);
+    }
+    return header.status;
+}
 
-                        tokens = NULL;
-                        clearBuffer(handle_client_buffer);
-                        recv(client_socket, handle_client_buffer, sizeof(handle_client_buffer), 0);
-                        
-                        if (handle_client_buffer[0] == '\0') {
-                            send(client_socket, &FALSE, sizeof(TRUE), 0);
-                            break;
-                        }
-                        
-                        tokenizeInput(handle_client_buffer, &tokens);
-                        
-                        if (tokens == NULL || tokens[0] == NULL || tokens[1] == NULL) {
-                            send(client_socket, &FALSE, sizeof(TRUE), 0);
-                            break;
-                        }
+// Send one request and wait for its response; returns the response status or -1
+static int clientRequest(int client_socket, int opcode, const void *request, size_t request_len,
+                         unsigned char *response, size_t response_cap, FrameCursor *cursor) {
+    uint32_t request_id = next_request_id++;
+    if (sendRequest(client_socket, opcode, request_id, request, request_len) == -1) {
+        return -1;
+    }
+    return receiveTagged(client_socket, request_id, response, response_cap, cursor);
+}
 
-                        if (createNewUser(ServerDatabase, tokens[0], tokens[1])){
-                            // Save the database after creating new user
-                            saveServerDatabaseToFile(ServerDatabase, DATABASE_FILE);
-                            send(client_socket, &TRUE, sizeof(TRUE), 0);
-                            printf("Account Creation Successful\n");
-                        } else{
-                            send(client_socket, &FALSE, sizeof(TRUE), 0);
-                            printf("Account Creation FAILED - Username may already exist\n");
-                        }
-                        
-                        // Free tokens safely - FIXED
-                        freeTokens(&tokens);
-                        clearBuffer(handle_client_buffer);
-                        break;
+// Fetch the user's accounts; the cursor is left at the first account record
+static int fetchAccounts(int client_socket, unsigned char *response, FrameCursor *cursor) {
+    if (clientRequest(client_socket, OP_VIEW_ACCOUNTS, NULL, 0,
+                      response, FRAME_MAX_PAYLOAD, cursor) != STATUS_OK) {
+        return -1;
+    }
+    int account_count = (int)frameGetU32(cursor);
+    return cursor->error ? -1 : account_count;
+}
 
-                    case 3:
-                        // Exit request
-                        printf("Requested \"Exit\". Exiting.\n");
-                        exit = true;
-                        break;
+// Fetch accounts and exchange rates with both requests in flight at once
+static int fetchAccountsAndRates(int client_socket, unsigned char *response, FrameCursor *cursor,
+                                 Coins *rates) {
+    unsigned char frames[2 * FRAME_HEADER_SIZE];
+    FrameCursor batch;
+    frameCursorInit(&batch, frames, sizeof(frames));
+    uint32_t accounts_id = next_request_id++;
+    uint32_t rates_id = next_request_id++;
+    queueRequest(&batch, OP_VIEW_ACCOUNTS, accounts_id, NULL, 0);
+    queueRequest(&batch, OP_GET_RATES, rates_id, NULL, 0);
+    if (sendFrames(client_socket, frames, batch.pos) == -1) return -1;
+    
+    // Responses come back in request order
+    int account_status = receiveTagged(client_socket, accounts_id, response, FRAME_MAX_PAYLOAD, cursor);
+    if (account_status == -1) return -1;
+    int account_count = (int)frameGetU32(cursor);
+    
+    unsigned char rate_payload[CURRENCY_COUNT * 8];
+    FrameCursor rate_cursor;
+    if (receiveTagged(client_socket, rates_id, rate_payload, sizeof(rate_payload), &rate_cursor) != STATUS_OK) {
+        return -1;
+    }
+    for (int c = 0; c < CURRENCY_COUNT; c++) {
+        rates->rate[c] = frameGetF64(&rate_cursor);
+    }
+    return account_status != STATUS_OK || cursor->error ? -1 : account_count;
+}
 
-                    default:
-                        // Unexpected request
-                        printf("Unexpected Error. Client Unresponsive: %d\n", client_socket);
-                        exit = true;
-                        break;
-                }
-            }
+static int selectCurrency(const char *prompt) {
+    // Currencies are shown 1-8 and sent 0-based
+    printf("%s\n 1: Euro, 2: Dollar, 3: Pound, 4: Yen, 5: Rupee, 6: Peso, 7: Franc, 8: Drachmas\n", prompt);
+    while (true) {
+        int currency = checkForInt();
+        if (currency < 1 || currency > CURRENCY_COUNT) {
+            printf("Invalid choice. Try again:");
         } else {
-            // Client disconnected unexpectedly
-            printf("Client Disconnected Unexpectedly. Server Stopped Receiving Data %d\n", client_socket);
-            exit = true;
+            return currency - 1;
         }
     }
-    
-    // Free allocated memory
-    free(clientAccount->username);
-    free(clientAccount->password);
-    free(clientAccount);
 }
 
-// ============================================================
-// Client Operations Function
-// ============================================================
+static int selectAccount(int account_count) {
+    while (true) {
+        int account = checkForInt();
+        if (account < 1 || account > account_count) {
+            printf("Invalid choice. Try again:");
+        } else {
+            return account;
+        }
+    }
+}
 
 void initiate_client_operations(int client_socket){
     bool isLoggedIn = false;
     bool exit = false;
     int client_option;
-    int conf_s = 0;
-    int TRUE = 1;
-    int FALSE = 0;
+    int status = 0;
     int input_count = 0;
-    char *terminationMessage = "LOGOUT_EXIT";
-    char temp_buffer[MAX_SIZE]; 
-    char buffer[MAX_SIZE];     
-    ssize_t bytes_received = 0;
+    char buffer[MAX_SIZE];
+    unsigned char request_buffer[MAX_SIZE];
+    unsigned char response[FRAME_MAX_PAYLOAD];
+    FrameCursor request, reply;
 
     while (!exit){
         if (isLoggedIn){
@@ -1047,115 +3093,98 @@ void initiate_client_operations(int client_socket){
             if (client_option < 1 || client_option > 10){
                 printf("Invalid Option, must be 1-10\n");
             } else {
-                printf("Valid Option %d. Sending to server\n", client_option);
-                send(client_socket, &client_option, sizeof(client_option), 0);
+                printf("Valid Option %d\n", client_option);
             }
         } else {
             if (client_option < 1 || client_option > 3){
                 printf("Invalid Option, must be 1-3\n");
             } else {
-                printf("Valid Option %d. Sending to server\n", client_option);
-                send(client_socket, &client_option, sizeof(client_option), 0);
+                printf("Valid Option %d\n", client_option);
             }
         }
 
         printf("Handling Input %d\n", input_count);
         input_count++;
+        frameCursorInit(&request, request_buffer, sizeof(request_buffer));
 
         if (isLoggedIn){
             switch (client_option){
-                case 1:
+                case 1: {
                     // View coin accounts
                     printf("Requested \"View Coin Accounts\"\n");
                     
-                    int account_count;
-                    recv(client_socket, &account_count, sizeof(account_count), 0);
-                    
-                    if (account_count <= 0) {
+                    int account_count = fetchAccounts(client_socket, response, &reply);
+                    if (account_count < 0) {
+                        printf("Could not retrieve accounts.\n");
+                    } else if (account_count == 0) {
                         printf("No accounts available.\n");
                     } else {
                         printf("You have %d accounts:\n", account_count);
                         for (int i = 0; i < account_count; i++) {
                             CurrencyAccount account;
-                            recv(client_socket, &account, sizeof(CurrencyAccount), 0);
-                            printf("Account %d (%s):\n", i + 1, account.is_shared ? "Shared" : "Personal");
-                            printf("  Euro: %.2f\n", account.coins.Euro);
-                            printf("  Dollar: %.2f\n", account.coins.Dollar);
-                            printf("  Pound: %.2f\n", account.coins.Pound);
-                            printf("  Yen: %.2f\n", account.coins.Yen);
-                            printf("  Rupee: %.2f\n", account.coins.Rupee);
-                            printf("  Peso: %.2f\n", account.coins.Peso);
-                            printf("  Franc: %.2f\n", account.coins.Franc);
-                            printf("  Drachmas: %.2f\n", account.coins.Drachmas);
-                            printf("  Total Balance (Euro): %.2f\n", account.total_balance);
+                            frameGetAccount(&reply, &account);
+                            printf("Account %d (%s, ID %d):\n", i + 1,
+                                   account.is_shared ? "Shared" : "Personal", account.account_id);
+                            for (int c = 0; c < CURRENCY_COUNT; c++) {
+                                printf("  %s: %.2f\n", getCurrencyName(c),
+                                       fromMinorUnits(c, getCurrencyBalance(&account, c)));
+                            }
+                            printf("  Total Balance (Euro): %.2f\n", fromMinorUnits(0, account.total_balance));
                         }
                     }
                     break;
+                }
                 
-                case 2:
+                case 2: {
                     // Exchange coins
                     printf("Requested \"Exchange Coins\"\n");
                     
-                    int ex_accounts;
-                    recv(client_socket, &ex_accounts, sizeof(ex_accounts), 0);
-                    
+                    Coins rates;
+                    int ex_accounts = fetchAccountsAndRates(client_socket, response, &reply, &rates);
                     if (ex_accounts <= 0) {
                         printf("No accounts available for exchange.\n");
                         break;
                     }
                     
                     printf("Select account for exchange (1-%d): ", ex_accounts);
-                    int ex_account = checkForInt();
-                    send(client_socket, &ex_account, sizeof(ex_account), 0);
-                    
-                    // Receive exchange rates
-                    Coins rates;
-                    recv(client_socket, &rates, sizeof(Coins), 0);
+                    int ex_account = selectAccount(ex_accounts);
                     
                     printf("Current Exchange Rates (to Euro):\n");
-                    printf("  Dollar: %.2f\n", rates.Dollar);
-                    printf("  Pound: %.2f\n", rates.Pound);
-                    printf("  Yen: %.2f\n", rates.Yen);
-                    printf("  Rupee: %.2f\n", rates.Rupee);
-                    printf("  Peso: %.2f\n", rates.Peso);
-                    printf("  Franc: %.2f\n", rates.Franc);
-                    printf("  Drachmas: %.2f\n", rates.Drachmas);
-                    
-                    printf("Select source currency:\n");
-                    printf("1: Euro, 2: Dollar, 3: Pound, 4: Yen, 5: Rupee, 6: Peso, 7: Franc, 8: Drachmas\n");
-                    int from_currency = checkForInt();
+                    for (int c = CURRENCY_DOLLAR; c < CURRENCY_COUNT; c++) {
+                        printf("  %s: %.2f\n", getCurrencyName(c), rates.rate[c]);
+                    }
                     
-                    printf("Select target currency:\n");
-                    printf("1: Euro, 2: Dollar, 3: Pound, 4: Yen, 5: Rupee, 6: Peso, 7: Franc, 8: Drachmas\n");
-                    int to_currency = checkForInt();
+                    int from_currency = selectCurrency("Select source currency:");
+                    int to_currency = selectCurrency("Select target currency:");
                     
                     printf("Enter amount to exchange: ");
-                    double exchange_amount = checkForInt();
-                    
-                    send(client_socket, &from_currency, sizeof(from_currency), 0);
-                    send(client_socket, &to_currency, sizeof(to_currency), 0);
-                    send(client_socket, &exchange_amount, sizeof(exchange_amount), 0);
+                    Money exchange_amount = 0;
+                    if (!toMinorUnits(from_currency, checkForInt(), &exchange_amount)) {
+                        printf("Invalid amount.\n");
+                        break;
+                    }
                     
-                    recv(client_socket, &conf_s, sizeof(conf_s), 0);
-                    if (conf_s) {
-                        double result;
-                        recv(client_socket, &result, sizeof(result), 0);
-                        printf("Exchange successful! Received: %.2f %s\n", result, getCurrencyName(to_currency - 1));
+                    framePutU32(&request, (uint32_t)ex_account);
+                    framePutU8(&request, (uint8_t)from_currency);
+                    framePutU8(&request, (uint8_t)to_currency);
+                    framePutI64(&request, exchange_amount);
+                    status = clientRequest(client_socket, OP_EXCHANGE, request_buffer, request.pos,
+                                           response, sizeof(response), &reply);
+                    if (status == STATUS_OK) {
+                        Money result = frameGetI64(&reply);
+                        printf("Exchange successful! Received: %.2f %s\n",
+                               fromMinorUnits(to_currency, result), getCurrencyName(to_currency));
                     } else {
                         printf("Exchange failed. Insufficient funds or invalid selection.\n");
                     }
                     break;
+                }
        
-                case 3:
+                case 3: {
                     // Withdraw coins from an account
                     printf("Requested \"Withdraw Coins from Account\"\n");
 
-                    int w_coin = 0;
-                    int w_accounts = 0;
-                    int w_account = 0;
-                    double w_amount = 0;
-
-                    recv(client_socket, &w_accounts, sizeof(w_accounts), 0);
+                    int w_accounts = fetchAccounts(client_socket, response, &reply);
                     if (w_accounts <= 0){
                         printf("No Coin Accounts Available\n");
                         break;
@@ -1165,67 +3194,45 @@ void initiate_client_operations(int client_socket){
                     for(int i = 0; i < w_accounts; i++){
                         printf("Account %d\n", i + 1);
                     }
+                    int w_account = selectAccount(w_accounts);
+                    printf("Valid choice. Initiating Coin Withdrawal Sequence\n");
 
-                    while(true){
-                        w_account = checkForInt();
-                        if (w_account < 1 || w_account > w_accounts){
-                            printf("Invalid choice. Try again:");
-                        } else {
-                            printf("Valid choice. Initiating Coin Withdrawal Sequence\n");
-                            break;
-                        }
+                    // Show the balances of the selected account
+                    CurrencyAccount account;
+                    for (int i = 0; i < w_account; i++) {
+                        frameGetAccount(&reply, &account);
                     }
-                    send(client_socket, &w_account, sizeof(w_account), 0);
-
-                    // Receive account balances
-                    Coins balances;
-                    recv(client_socket, &balances, sizeof(Coins), 0);
-                    
                     printf("Current Balances:\n");
-                    printf("  Euro: %.2f\n", balances.Euro);
-                    printf("  Dollar: %.2f\n", balances.Dollar);
-                    printf("  Pound: %.2f\n", balances.Pound);
-                    printf("  Yen: %.2f\n", balances.Yen);
-                    printf("  Rupee: %.2f\n", balances.Rupee);
-                    printf("  Peso: %.2f\n", balances.Peso);
-                    printf("  Franc: %.2f\n", balances.Franc);
-                    printf("  Drachmas: %.2f\n", balances.Drachmas);
-
-                    printf("Select coin type to withdraw:\n 1: Euro, 2: Dollar, 3: Pound, 4: Yen, 5: Rupee, 6: Peso, 7: Franc, 8: Drachmas\n");
-                    while(true){
-                        w_coin = checkForInt();
-                        if (w_coin < 1 || w_coin > 8){
-                            printf("Invalid choice. Try again:");
-                        } else {
-                            printf("Valid choice. Continuing Coin Withdrawal Sequence\n");
-                            break;
-                        }
+                    for (int c = 0; c < CURRENCY_COUNT; c++) {
+                        printf("  %s: %.2f\n", getCurrencyName(c), fromMinorUnits(c, account.coins[c]));
                     }
 
+                    int w_coin = selectCurrency("Select coin type to withdraw:");
                     printf("Enter amount to withdraw:\n");
-                    w_amount = checkForInt();
-
-                    send(client_socket, &w_coin, sizeof(w_coin), 0);
-                    send(client_socket, &w_amount, sizeof(w_amount), 0);
+                    Money w_amount = 0;
+                    if (!toMinorUnits(w_coin, checkForInt(), &w_amount)) {
+                        printf("Invalid amount.\n");
+                        break;
+                    }
 
-                    recv(client_socket, &conf_s, sizeof(conf_s), 0);                
-                    if (conf_s){
+                    framePutU32(&request, (uint32_t)w_account);
+                    framePutU8(&request, (uint8_t)w_coin);
+                    framePutI64(&request, w_amount);
+                    status = clientRequest(client_socket, OP_WITHDRAW, request_buffer, request.pos,
+                                           response, sizeof(response), NULL);
+                    if (status == STATUS_OK){
                         printf("Coins Successfully Withdrawn\n");
                     } else {
                         printf("Coin Withdrawal Failed. Insufficient Balance\n");
                     }
                     break;
+                }
                 
-                case 4:
+                case 4: {
                     // Deposit coins to an account
                     printf("Requested \"Deposit Coins to Account\"\n");
 
-                    int d_coin = 0;
-                    int d_accounts = 0;
-                    int d_account = 0;
-                    double d_amount = 0;
-
-                    recv(client_socket, &d_accounts, sizeof(d_accounts), 0);
+                    int d_accounts = fetchAccounts(client_socket, response, &reply);
                     if (d_accounts <= 0){
                         printf("No Coin Accounts Available\n");
                         break;
@@ -1235,51 +3242,40 @@ void initiate_client_operations(int client_socket){
                     for(int i = 0; i < d_accounts; i++){
                         printf("Account %d\n", i + 1);
                     }
-                    while(true){
-                        d_account = checkForInt();
-                        if (d_account < 1 || d_account > d_accounts){
-                            printf("Invalid choice. Try again:");
-                        } else {
-                            printf("Valid choice. Initiating Coin Deposit Sequence\n");
-                            break;
-                        }
-                    }
-
-                    printf("Select coin type to deposit:\n 1: Euro, 2: Dollar, 3: Pound, 4: Yen, 5: Rupee, 6: Peso, 7: Franc, 8: Drachmas\n");
-                    while(true){
-                        d_coin = checkForInt();
-                        if (d_coin < 1 || d_coin > 8){
-                            printf("Invalid choice. Try again:");
-                        } else {
-                            printf("Valid choice. Continuing Coin Deposit Sequence\n");
-                            break;
-                        }
-                    }
+                    int d_account = selectAccount(d_accounts);
+                    printf("Valid choice. Initiating Coin Deposit Sequence\n");
 
+                    int d_coin = selectCurrency("Select coin type to deposit:");
                     printf("Enter amount to deposit:\n");
-                    d_amount = checkForInt();
-
-                    send(client_socket, &d_account, sizeof(d_account), 0);
-                    send(client_socket, &d_coin, sizeof(d_coin), 0);
-                    send(client_socket, &d_amount, sizeof(d_amount), 0);
+                    Money d_amount = 0;
+                    if (!toMinorUnits(d_coin, checkForInt(), &d_amount)) {
+                        printf("Invalid amount.\n");
+                        break;
+                    }
 
-                    recv(client_socket, &conf_s, sizeof(conf_s), 0);                
-                    if (conf_s){
+                    framePutU32(&request, (uint32_t)d_account);
+                    framePutU8(&request, (uint8_t)d_coin);
+                    framePutI64(&request, d_amount);
+                    status = clientRequest(client_socket, OP_DEPOSIT, request_buffer, request.pos,
+                                           response, sizeof(response), NULL);
+                    if (status == STATUS_OK){
                         printf("Coins Successfully Deposited\n");
                     } else {
                         printf("Coin Deposit Failed\n");
                     }
                     break;
+                }
                 
-                case 5:
+                case 5: {
                     // Create a new coin account
                     printf("Requested \"Create Coin Account\"\n");
-                    int initDepo = 0;
                     int isShared = 0;
 
-                    conf_s = 0;
                     printf("\nEnter Initial Deposit Amount (Euro): ");
-                    initDepo = checkForInt();
+                    Money initDepo = 0;
+                    if (!toMinorUnits(CURRENCY_EURO, checkForInt(), &initDepo)) {
+                        initDepo = -1; // Rejected by the server
+                    }
 
                     printf("\nIs it a Shared Account? 1 = YES / 0 = NO: ");
                     while(true){
@@ -1292,23 +3288,22 @@ void initiate_client_operations(int client_socket){
                         }
                     }
 
-                    send(client_socket, &initDepo, sizeof(initDepo), 0);
-                    send(client_socket, &isShared, sizeof(isShared), 0);
-
-                    recv(client_socket, &conf_s, sizeof(conf_s), 0);                
-                    if (conf_s){
+                    framePutI64(&request, initDepo);
+                    framePutU8(&request, (uint8_t)isShared);
+                    status = clientRequest(client_socket, OP_CREATE_ACCOUNT, request_buffer, request.pos,
+                                           response, sizeof(response), NULL);
+                    if (status == STATUS_OK){
                         printf("Coin Account Successfully Created\n");
                     } else {
                         printf("Coin Account Creation Failed\n");
                     }
                     break;
+                }
                 
-                case 6:
+                case 6: {
                     printf("Requested \"Delete Coin Account\"\n");
                     
-                    int del_accounts;
-                    recv(client_socket, &del_accounts, sizeof(del_accounts), 0);
-                    
+                    int del_accounts = fetchAccounts(client_socket, response, &reply);
                     if (del_accounts <= 0) {
                         printf("No accounts to delete.\n");
                         break;
@@ -1316,31 +3311,101 @@ void initiate_client_operations(int client_socket){
                     
                     printf("Select account to delete (1-%d): ", del_accounts);
                     int account_to_delete = checkForInt();
-                    send(client_socket, &account_to_delete, sizeof(account_to_delete), 0);
-                    
-                    recv(client_socket, &conf_s, sizeof(conf_s), 0);
-                    if (conf_s) {
+                    framePutU32(&request, (uint32_t)account_to_delete);
+                    status = clientRequest(client_socket, OP_DELETE_ACCOUNT, request_buffer, request.pos,
+                                           response, sizeof(response), NULL);
+                    if (status == STATUS_OK) {
                         printf("Account deleted successfully.\n");
                     } else {
                         printf("Account deletion failed.\n");
                     }
                     break;
+                }
                 
-                case 7:
-                    printf("Requested \"Send or Request Coins\"\n");
-                    recv(client_socket, &conf_s, sizeof(conf_s), 0);
-                    if (!conf_s) {
-                        printf("This feature is not yet implemented.\n");
+                case 7: {
+                    // Send coins to any account, including another user's
+                    printf("Requested \"Send Coins\"\n");
+
+                    int t_accounts = fetchAccounts(client_socket, response, &reply);
+                    if (t_accounts <= 0) {
+                        printf("No Coin Accounts Available\n");
+                        break;
+                    }
+                    printf("Which Account do you want to send from? (1-%d)\n", t_accounts);
+                    int t_account = selectAccount(t_accounts);
+
+                    int t_coin = selectCurrency("Select coin type to send:");
+                    printf("Enter amount to send:\n");
+                    Money t_amount = 0;
+                    if (!toMinorUnits(t_coin, checkForInt(), &t_amount) || t_amount <= 0) {
+                        printf("Invalid amount.\n");
+                        break;
+                    }
+
+                    // Read as long a name as the server accepts and drop
+                    // the rest of the line, so it never feeds the next prompt
+                    char recipient[CREDENTIAL_SIZE];
+                    char recipient_format[16];
+                    snprintf(recipient_format, sizeof(recipient_format), "%%%ds", CREDENTIAL_SIZE - 1);
+                    printf("Enter the recipient's UserName: ");
+                    if (scanf(recipient_format, recipient) != 1) recipient[0] = '\0';
+                    fixBuffer();
+                    printf("Enter the recipient's account ID: ");
+                    int recipient_account = checkForInt();
+
+                    framePutU32(&request, (uint32_t)t_account);
+                    framePutU8(&request, (uint8_t)t_coin);
+                    framePutI64(&request, t_amount);
+                    framePutU32(&request, (uint32_t)recipient_account);
+                    framePutU8(&request, (uint8_t)strlen(recipient));
+                    framePutBytes(&request, recipient, strlen(recipient));
+                    status = clientRequest(client_socket, OP_TRANSFER, request_buffer, request.pos,
+                                           response, sizeof(response), NULL);
+                    if (status == STATUS_OK) {
+                        printf("Coins Successfully Sent to %s\n", recipient);
+                    } else {
+                        printf("Transfer Failed. Insufficient balance or unknown recipient account\n");
                     }
                     break;
+                }
                 
-                case 8:
+                case 8: {
                     printf("Requested \"Transaction History\"\n");
+                    
+                    // Page backwards from the newest transaction
+                    long cursor = HISTORY_CURSOR_LATEST;
+                    while (true) {
+                        frameCursorInit(&request, request_buffer, sizeof(request_buffer));
+                        framePutI64(&request, cursor);
+                        framePutU32(&request, HISTORY_PAGE_SIZE);
+                        if (clientRequest(client_socket, OP_HISTORY, request_buffer, request.pos,
+                                          response, sizeof(response), &reply) != STATUS_OK) {
+                            printf("Could not retrieve transaction history.\n");
+                            break;
+                        }
+                        
+                        int tx_count = (int)frameGetU32(&reply);
+                        if (tx_count <= 0 && cursor == HISTORY_CURSOR_LATEST) {
+                            printf("No transactions found.\n");
+                        }
+                        for (int i = 0; i < tx_count && !reply.error; i++) {
+                            Transaction transaction;
+                            frameGetTransaction(&reply, &transaction);
+                            printTransaction(&transaction);
+                        }
+                        cursor = (long)frameGetI64(&reply);
+                        
+                        if (reply.error || tx_count <= 0 || cursor <= 0) break;
+                        printf("Show older transactions? 1 = YES / 0 = NO: ");
+                        if (checkForInt() != 1) break;
+                    }
                     break;
+                }
                                             
                 case 9:
                     // Logout and exit
                     printf("Requested \"Logout & Exit\"\n");
+                    sendRequest(client_socket, OP_LOGOUT, next_request_id++, NULL, 0);
                     exit = true;
                     isLoggedIn = false;
                     printf("Exiting. Bye!\n");
@@ -1348,8 +3413,9 @@ void initiate_client_operations(int client_socket){
 
                 case 10:
                     printf("Requested \"Delete My Account\"\n");
-                    recv(client_socket, &conf_s, sizeof(conf_s), 0);
-                    if (!conf_s) {
+                    status = clientRequest(client_socket, OP_DELETE_USER, NULL, 0,
+                                           response, sizeof(response), NULL);
+                    if (status == STATUS_UNSUPPORTED) {
                         printf("This feature is not yet implemented.\n");
                     }
                     break;
@@ -1363,33 +3429,30 @@ void initiate_client_operations(int client_socket){
                 case 1:
                     // Login
                     printf("Requested \"Login\"\n");
+                    clearBuffer(buffer);
+                    loginData(buffer, sizeof(buffer));
 
-                    int usernameCheck, passwordCheck;
-
-                    confirmLoginDataTransfer(client_socket, buffer, sizeof(buffer), &conf_s);
-
-                    recv(client_socket, &usernameCheck, sizeof(usernameCheck), 0);
-                    recv(client_socket, &passwordCheck, sizeof(passwordCheck), 0);
-
-                    if (usernameCheck && passwordCheck){
+                    status = clientRequest(client_socket, OP_LOGIN, buffer, strlen(buffer),
+                                           response, sizeof(response), NULL);
+                    if (status == STATUS_OK){
                         isLoggedIn = true;
                         printf("Successfully Logged in.\n");
-                    } else if (!usernameCheck && !passwordCheck){
-                        isLoggedIn = false;
-                        printf("Log in failed. User does not exist\n");
-                    } else if (!usernameCheck){
-                        printf("Log in failed. Incorrect username\n");
-                    } else if (!passwordCheck){
-                        printf("Log in failed. Incorrect password\n");
+                    } else if (status == STATUS_FAILED){
+                        printf("Log in failed. Incorrect username or password\n");
+                    } else {
+                        printf("Log in failed. Server error\n");
                     }
                     break;
                 
                 case 2:
                     // Create new user account
                     printf("Requested \"Create User Account\"\n");
-                    confirmLoginDataTransfer(client_socket, buffer, sizeof(buffer), &conf_s);
+                    clearBuffer(buffer);
+                    loginData(buffer, sizeof(buffer));
 
-                    if (conf_s == 1){
+                    status = clientRequest(client_socket, OP_REGISTER, buffer, strlen(buffer),
+                                           response, sizeof(response), NULL);
+                    if (status == STATUS_OK){
                         printf("Account Created Successfully\n");
                     } else {
                         printf("Account Creation Failed - Username may already exist\n");
@@ -1399,6 +3462,7 @@ void initiate_client_operations(int client_socket){
                 case 3:
                     // Exit client
                     printf("Requested \"Exit\"\n");
+                    sendRequest(client_socket, OP_QUIT, next_request_id++, NULL, 0);
                     exit = true;
                     printf("Exiting. Bye!\n");
                     break;
@@ -1408,7 +3472,225 @@ void initiate_client_operations(int client_socket){
                     break;
             }
         }
+
+        if (status == -1) {
+            // The connection is gone, nothing more can be sent
+            exit = true;
+        }
+    }
+}
+
+// ============================================================
+// Portfolio Revaluation
+// ============================================================
+
+// Rate changes are coalesced: however many land while a revaluation runs,
+// the worker runs once more afterwards at the latest rates
+static pthread_mutex_t revaluation_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t revaluation_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t revaluation_thread;
+static bool revaluation_running = false;
+static bool revaluation_stopping = false;
+static bool revaluation_pending = false;
+
+// One thread's share of a revaluation: a contiguous range of users
+typedef struct {
+    ServerDatabase *db;
+    int first_user;
+    int end_user;
+    long accounts;
+} RevaluationSlice;
+
+static void* revalue_slice(void *arg) {
+    RevaluationSlice *slice = arg;
+    ServerDatabase *db = slice->db;
+    for (int u = slice->first_user; u < slice->end_user; u++) {
+        // One user at a time under the shared lock, so requests and account
+        // changes go on between users
+        pthread_rwlock_rdlock(&db->lock);
+        UserAccount *user = &db->userAccountArr[u];
+        for (int a = 0; a < user->currencyAccountNum; a++) {
+            // Rates are read under the account's stripe: updates that hold it
+            // before this used the old rates and are overwritten here, and
+            // the ones after it use these rates or newer ones
+            CurrencyAccount *account = &user->currencyAccounts[a];
+            RateReadGuard guard;
+            lockAccount(db, user->client_id, account->account_id);
+            refreshAccountTotal(account, &acquireRates(db, &guard)->table);
+            releaseRates(&guard);
+            unlockAccount(db, user->client_id, account->account_id);
+        }
+        slice->accounts += user->currencyAccountNum;
+        pthread_rwlock_unlock(&db->lock);
+    }
+    return NULL;
+}
+
+long revalueAllAccounts(ServerDatabase *db) {
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    
+    // Recompute every Euro total from scratch, account by account, while
+    // requests keep running. Users are never removed, so the ranges stay
+    // valid; accounts created meanwhile start with a total at current rates.
+    pthread_rwlock_rdlock(&db->lock);
+    int users = db->totalUsers;
+    pthread_rwlock_unlock(&db->lock);
+    
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = users / REVALUATION_MIN_USERS + 1;
+    if (threads > cpus) threads = cpus > 0 ? (int)cpus : 1;
+    if (threads > REVALUATION_MAX_THREADS) threads = REVALUATION_MAX_THREADS;
+    
+    RevaluationSlice slices[REVALUATION_MAX_THREADS];
+    pthread_t workers[REVALUATION_MAX_THREADS];
+    bool started_worker[REVALUATION_MAX_THREADS] = {false};
+    for (int t = 0; t < threads; t++) {
+        slices[t] = (RevaluationSlice){ db, (int)((long)users * t / threads),
+                                        (int)((long)users * (t + 1) / threads), 0 };
+    }
+    
+    // The calling thread takes the first slice; if a helper cannot be
+    // started its slice is revalued here as well
+    for (int t = 1; t < threads; t++) {
+        started_worker[t] = pthread_create(&workers[t], NULL, revalue_slice, &slices[t]) == 0;
+    }
+    revalue_slice(&slices[0]);
+    long accounts = slices[0].accounts;
+    for (int t = 1; t < threads; t++) {
+        if (started_worker[t]) {
+            pthread_join(workers[t], NULL);
+        } else {
+            revalue_slice(&slices[t]);
+        }
+        accounts += slices[t].accounts;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    printf("Revalued %ld accounts in %.2f ms on %d threads\n", accounts,
+           (finished.tv_sec - started.tv_sec) * 1000.0 + (finished.tv_nsec - started.tv_nsec) / 1e6,
+           threads);
+    return accounts;
+}
+
+void requestRevaluation() {
+    pthread_mutex_lock(&revaluation_mutex);
+    revaluation_pending = true;
+    pthread_cond_signal(&revaluation_cond);
+    pthread_mutex_unlock(&revaluation_mutex);
+}
+
+static void* revaluation_worker(void *arg) {
+    ServerDatabase *db = arg;
+    
+    pthread_mutex_lock(&revaluation_mutex);
+    while (true) {
+        while (!revaluation_pending && !revaluation_stopping) {
+            pthread_cond_wait(&revaluation_cond, &revaluation_mutex);
+        }
+        if (revaluation_stopping) break;
+        revaluation_pending = false;
+        pthread_mutex_unlock(&revaluation_mutex);
+        
+        revalueAllAccounts(db);
+        
+        pthread_mutex_lock(&revaluation_mutex);
+    }
+    pthread_mutex_unlock(&revaluation_mutex);
+    return NULL;
+}
+
+int startRevaluationWorker(ServerDatabase *db) {
+    revaluation_stopping = false;
+    if (pthread_create(&revaluation_thread, NULL, revaluation_worker, db) != 0) {
+        perror("Revaluation thread creation failed");
+        return 0;
+    }
+    revaluation_running = true;
+    return 1;
+}
+
+void stopRevaluationWorker() {
+    if (!revaluation_running) return;
+    
+    pthread_mutex_lock(&revaluation_mutex);
+    revaluation_stopping = true;
+    pthread_cond_signal(&revaluation_cond);
+    pthread_mutex_unlock(&revaluation_mutex);
+    pthread_join(revaluation_thread, NULL);
+    revaluation_running = false;
+}
+
+// ============================================================
+// Background Snapshots
+// ============================================================
+
+int snapshot_interval_sec = SNAPSHOT_DEFAULT_INTERVAL_SEC;
+static volatile bool snapshot_requested = false;
+static long last_snapshot_sequence = -1;
+
+int snapshotServerDatabase(ServerDatabase *db) {
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    
+    // Freeze a point-in-time copy: fork while no request step is running, so
+    // the child's copy-on-write image is consistent, and start a new log
+    // segment at the same instant so the snapshot covers exactly the old one
+    pthread_rwlock_wrlock(&db->lock);
+    long sequence = db->wal_sequence;
+    if (sequence == last_snapshot_sequence) {
+        pthread_rwlock_unlock(&db->lock);
+        return 1;
+    }
+    int rotated = rotateWriteAheadLog();
+    pid_t pid = fork();
+    pthread_rwlock_unlock(&db->lock);
+    
+    if (pid == -1) {
+        perror("Snapshot fork failed");
+        return 0;
+    }
+    if (pid == 0) {
+        // Child: drop inherited sockets so clients never wait on this process,
+        // write the frozen image and leave without flushing the parent's stdio
+        close_range(3, ~0U, 0);
+        _exit(writeDatabaseSnapshot(db, DATABASE_FILE) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        printf("Background snapshot failed; keeping write-ahead log segments\n");
+        return 0;
+    }
+    
+    // The snapshot now holds every record of the rotated segment
+    discardRotatedWriteAheadLog();
+    last_snapshot_sequence = sequence;
+    
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    printf("Snapshot at log sequence %ld written in %.1f ms%s\n", sequence,
+           (finished.tv_sec - started.tv_sec) * 1000.0 + (finished.tv_nsec - started.tv_nsec) / 1e6,
+           rotated ? "" : " (log compaction deferred)");
+    return 1;
+}
+
+void* snapshot_worker(void* arg) {
+    ServerDatabase *db = arg;
+    int elapsed = 0;
+    
+    while (server_running) {
+        sleep(1);
+        elapsed++;
+        if (!server_running) break;
+        
+        if (snapshot_requested || (snapshot_interval_sec > 0 && elapsed >= snapshot_interval_sec)) {
+            snapshot_requested = false;
+            elapsed = 0;
+            snapshotServerDatabase(db);
+        }
     }
+    pthread_exit(NULL);
 }
 
 // ============================================================
@@ -1478,20 +3760,52 @@ int checkInput(int choice) {
 
 void* server_command_listener(void* arg) {
     char command[100];
-    int server_socket = *((int*)arg);
+    ServerDatabase *db = arg;
     
     while (server_running) {
         printf("You can now type server commands\n");
+        printf("Type \"stats\" for group commit statistics\n");
+        printf("Type \"snapshot\" to write a database snapshot now\n");
+        printf("Type \"rates\" to list exchange rates, \"rate <currency> <value>\" to change one\n");
+        printf("Type \"totals\" for the amount of each currency held, \"audit\" to check them by a full scan\n");
         printf("Type \"shutdown\" to close server\n\n");
 
         if (fgets(command, sizeof(command), stdin) != NULL) {
             command[strcspn(command, "\n")] = 0;
-
-            if (strcmp(command, "shutdown") == 0) {
+            char currency[32];
+            double value;
+
+            if (strcmp(command, "stats") == 0) {
+                printWalCommitStats();
+            } else if (strcmp(command, "rates") == 0) {
+                RateReadGuard guard;
+                const RateSet *rates = acquireRates(db, &guard);
+                for (int c = 0; c < CURRENCY_COUNT; c++) {
+                    printf("  %-9s %.6f\n", getCurrencyName(c), rates->rates.rate[c]);
+                }
+                releaseRates(&guard);
+            } else if (sscanf(command, "rate %31s %lf", currency, &value) == 2) {
+                if (publishExchangeRate(db, getCurrencyIndex(currency), value)) {
+                    printf("%s rate set to %.6f\n", currency, value);
+                } else {
+                    printf("Invalid currency or rate\n");
+                }
+            } else if (strcmp(command, "totals") == 0) {
+                Money totals[CURRENCY_COUNT];
+                readCurrencyTotals(totals);
+                for (int c = 0; c < CURRENCY_COUNT; c++) {
+                    printf("  %-9s %.2f\n", getCurrencyName(c), fromMinorUnits(c, totals[c]));
+                }
+            } else if (strcmp(command, "audit") == 0) {
+                auditCurrencyTotals(db);
+            } else if (strcmp(command, "snapshot") == 0) {
+                snapshot_requested = true;
+                printf("Snapshot requested\n");
+            } else if (strcmp(command, "shutdown") == 0) {
                 pthread_mutex_lock(&server_state_mutex);
                 server_running = false;
                 pthread_mutex_unlock(&server_state_mutex);
-                if (close(server_socket) == -1)
+                if (close(server_socket_main) == -1)
                     printf("FAILED");
                 printf("Shutting down server...\n");
             }
@@ -1501,14 +3815,7 @@ void* server_command_listener(void* arg) {
 }
 
 void initializeCoins(Coins *coins) {
-    coins->Euro = 1.00;
-    coins->Dollar = 1.08;
-    coins->Franc = 6.55;
-    coins->Peso = 166.38;
-    coins->Rupee = 89.98;
-    coins->Pound = 0.85;
-    coins->Yen = 158.83;
-    coins->Drachmas = 340.75;
+    initializeExchangeRates(coins);
 }
 
 void signal_handler(int sig) {
@@ -1525,11 +3832,10 @@ UserAccount* searchUserByUsername(ServerDatabase* db, const char* username) {
         return NULL;
     }
 
-    for (int i = 0; i < db->totalUsers; i++) {
-        if (strcmp(db->userAccountArr[i].username, username) == 0) {
-            printf("Username found\n");
-            return &db->userAccountArr[i];
-        }
+    int user_index = findUserByUsername(db, username);
+    if (user_index != -1) {
+        printf("Username found\n");
+        return &db->userAccountArr[user_index];
     }
 
     printf("Could not find username: %s\n", username);
@@ -1545,7 +3851,7 @@ void displayMenu(bool loggedIn) {
         printf("4. Deposit Coins to Account\n");
         printf("5. Create Coin Account\n");
         printf("6. Delete Coin Account\n");
-        printf("7. Send or Request Coins\n");
+        printf("7. Send Coins\n");
         printf("8. Transaction History\n");
         printf("9. Logout & Exit\n");
         printf("10. Delete My Account\n");
@@ -1591,51 +3897,45 @@ int deepCopyUserAccount(UserAccount* destination, const UserAccount* source) {
         destination->currencyAccounts = NULL;
     }
 
+    // The copy does not share the source's transaction history
+    destination->history = NULL;
+    destination->historyCount = 0;
+    destination->historyCapacity = 0;
+
     return 1;
 }
 
-int lock_file(int fd, bool operation) {
+int lock_file_range(int fd, off_t start, off_t len, bool operation) {
+    // Record lock on [start, start + len); len 0 runs to the end of the file.
+    // fcntl locks belong to the process, so they only exclude other processes.
     struct flock fl;
+    fl.l_type = operation ? F_WRLCK : F_UNLCK;
     fl.l_whence = SEEK_SET;
-    fl.l_start = 0;
-    fl.l_len = 0;
+    fl.l_start = start;
+    fl.l_len = len;
 
-    if (operation){
-        fl.l_type = F_WRLCK;
-        if (fcntl(fd, F_SETLKW, &fl) == -1) {
-            perror("Error locking file");
-            return -1;
-        }
-        printf("File Locked Successfully\n");
-    } else {
-        fl.l_type = F_UNLCK;
-        if (fcntl(fd, F_SETLK, &fl) == -1) {
-            perror("Error unlocking file");
-            return -1;
-        }
-        printf("File Unlocked Successfully\n");
+    while (fcntl(fd, operation ? F_SETLKW : F_SETLK, &fl) == -1) {
+        if (errno == EINTR) continue;
+        perror(operation ? "Error locking file range" : "Error unlocking file range");
+        return -1;
     }
     return 0;
 }
 
-void confirmLoginDataTransfer(int socket, char buffer[], size_t bufferSize, int *conf_s){
-    clearBuffer(buffer);
-    loginData(buffer, bufferSize);
-
-    send(socket, buffer, strlen(buffer), 0);
-
-    recv(socket, conf_s, sizeof(*conf_s), 0);
-
-    if (*conf_s) {
-        printf("Server received the data successfully\n");
-    } else {
-        printf("Server error while receiving the data\n");
+int lock_file(int fd, bool operation) {
+    if (lock_file_range(fd, 0, 0, operation) == -1) {
+        return -1;
     }
+    printf(operation ? "File Locked Successfully\n" : "File Unlocked Successfully\n");
+    return 0;
 }
 
 void initializeUserAccount(UserAccount *userAccount){
     userAccount->coin_account_id_counter = 1;
     userAccount->currencyAccounts = malloc(sizeof(CurrencyAccount));
+    userAccount->history = NULL;
+    userAccount->historyCount = 0;
+    userAccount->historyCapacity = 0;
 }
 
 void loginData(char buffer[], size_t bufferSize){
@@ -1702,15 +4002,8 @@ void socketPerror(int socket){
     }
 }
 
-void forkPerror(int pid){
-    if (pid < 0){
-        perror("Error forking process");
-        exit(EXIT_FAILURE);
-    }
-}
-
 void listenPerror(int socket){
-    if (listen(socket, 5) == -1) {
+    if (listen(socket, SOMAXCONN) == -1) {
         perror("Error listening");
         exit(EXIT_FAILURE);
     }
@@ -3,37 +3,108 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include <pthread.h>
 
 #define DELIMS "\t\r\n"
 #define MAX_SIZE 1024
 #define DATABASE_FILE "database.txt"
 #define LOCK_FILE "database.lock"
+#define WAL_FILE "database.wal"
+#define WAL_ROTATED_FILE "database.wal.1"   // Log segment awaiting the running snapshot
+#define DB_FILE_MAGIC 0x42444543    // "CEDB" header marking a versioned snapshot
+#define DB_FILE_VERSION 3           // 3: balances stored as integer minor units
+#define CREDENTIAL_SIZE 64
+#define WAL_DEFAULT_BATCH_SIZE 64   // Records per group commit before flushing early
+#define WAL_DEFAULT_MAX_DELAY_MS 2  // Longest a record waits for its batch
+#define WAL_STAT_BUCKETS 12
+#define SNAPSHOT_DEFAULT_INTERVAL_SEC 60
+#define USERNAME_INDEX_MIN_SIZE 64  // Hash index slots; always a power of two
+#define WAL_RECORD_FORMAT 2         // 0: double amounts, 1: format not checksummed
+#define RATE_SCALE 1000000          // Exchange rates are applied as millionths
+#define HISTORY_PAGE_SIZE 50        // Most transactions sent per history page
+#define HISTORY_CURSOR_LATEST -1    // Cursor asking for the newest page
+#define PROTOCOL_VERSION 3          // Version 2 added request ids, 3 linked transactions
+#define FRAME_HEADER_SIZE 12        // version, opcode, status, request id, payload length
+#define FRAME_MAX_PAYLOAD 16384     // Largest response payload a client accepts
+#define FRAME_MAX_REQUEST (256 * 1024)  // Largest request frame; session input grows to fit
+#define BATCH_TRANSFER_MAX_ITEMS 8192   // Most payments in one batch transfer
+#define CONVERT_BATCH_MAX_ITEMS 2016    // Most amounts in one batch conversion; the reply just fits FRAME_MAX_PAYLOAD
+#define SESSION_ARENA_SIZE 512      // Scratch bytes each session holds inline
+#define TRANSACTION_SLAB_SLOTS 4096 // Transactions per slab block (large enough to be mmap-backed)
+#define ACCOUNT_LOCK_STRIPES 256    // Account lock table size; always a power of two
+#define RATE_READER_SLOTS 64        // Rate reader counters; threads share them round-robin
+#define CURRENCY_TOTAL_SLOTS 64     // Per-thread counter slots behind the per-currency totals
+#define REVALUATION_MAX_THREADS 64  // Most threads one portfolio revaluation splits across
+#define REVALUATION_MIN_USERS 2048  // Users per revaluation thread before another is worth starting
 
 // Global Variables
 extern volatile bool server_running;
 extern pthread_mutex_t server_state_mutex;
 extern int server_socket_main;
 extern jmp_buf env;
+extern int snapshot_interval_sec;
+extern const char *admin_username;
+
+// Supported currencies; values index every per-currency array
+typedef enum {
+    CURRENCY_EURO,
+    CURRENCY_DOLLAR,
+    CURRENCY_POUND,
+    CURRENCY_YEN,
+    CURRENCY_RUPEE,
+    CURRENCY_PESO,
+    CURRENCY_FRANC,
+    CURRENCY_DRACHMAS,
+    CURRENCY_COUNT
+} Currency;
 
 // Structure for Exchange Rates (to Euro)
 typedef struct {
-    double Euro;
-    double Dollar;
-    double Pound;
-    double Yen;
-    double Rupee;
-    double Peso;
-    double Franc;
-    double Drachmas;
+    double rate[CURRENCY_COUNT];
 } Coins;
 
+// Monetary amount in minor units of its currency (cents, or whole Yen)
+typedef int64_t Money;
+
+// Conversion factor between the minor units of two currencies:
+// to_amount = from_amount * numerator / denominator
+typedef struct {
+    Money numerator;
+    Money denominator;
+    Money fast_limit;   // Largest magnitude whose product with numerator fits 64 bits
+} CrossRate;
+
+// Every pairwise conversion, rebuilt whenever the exchange rates change
+typedef struct {
+    CrossRate cross[CURRENCY_COUNT][CURRENCY_COUNT];
+} ExchangeTable;
+
+// One published generation of exchange rates; never modified once published
+typedef struct {
+    Coins rates;
+    ExchangeTable table;    // Derived from rates
+} RateSet;
+
+// Readers inside a rate read section, split by grace period parity and
+// padded so threads on different slots never share a cache line
+typedef struct {
+    unsigned long readers[2];
+} __attribute__((aligned(64))) RateReaderSlot;
+
+// Held between acquireRates and releaseRates
+typedef struct {
+    RateReaderSlot *slot;
+    int parity;
+} RateReadGuard;
+
 // Structure for currency account
 typedef struct {
     int account_id;
     int is_shared;
-    Coins coins;
-    double total_balance;
+    Money coins[CURRENCY_COUNT];
+    Money total_balance;    // Euro cents, kept current by balance updates and revaluations
 } CurrencyAccount;
 
 // Structure for user account
@@ -44,6 +115,9 @@ typedef struct {
     char *username;
     char *password;
     CurrencyAccount *currencyAccounts;
+    struct Transaction **history;   // This user's transactions, oldest first
+    int historyCount;
+    int historyCapacity;
 } UserAccount;
 
 // Structure for transaction
@@ -54,72 +128,364 @@ typedef struct Transaction {
     char transaction_type[20];
     char currency_from[20];
     char currency_to[20];
-    double amount_from;
-    double amount_to;
+    Money amount_from;
+    Money amount_to;
     double exchange_rate;
     time_t timestamp;
-    struct Transaction *next;
+    int linked_transaction_id;  // Other half of a transfer, 0 if none
 } Transaction;
 
+// Block of fixed-size slots handed out by a slab allocator
+typedef struct SlabBlock {
+    struct SlabBlock *next;
+    size_t used;            // Slots carved from this block so far
+    char slots[];
+} SlabBlock;
+
+// Fixed-size allocator: slots come from large blocks and are reused
+// through a free list; destroying the allocator releases every block at once
+typedef struct {
+    size_t slot_size;
+    size_t slots_per_block;
+    SlabBlock *blocks;      // Newest block first; only it has uncarved slots
+    void *free_list;        // Released slots, linked through their first bytes
+    size_t live_slots;
+    size_t block_count;
+} SlabAllocator;
+
+// Mutex padded to a cache line so neighbouring stripes never share one.
+// The sequence is odd while the holder is changing balances, so readers
+// can copy an account without taking the mutex (a seqlock).
+typedef struct {
+    pthread_mutex_t mutex;
+    unsigned sequence;
+} __attribute__((aligned(64))) LockStripe;
+
+// One payment of a batch transfer; to is NULL when the recipient is unknown
+typedef struct {
+    UserAccount *recipient;
+    CurrencyAccount *to;
+    int currency;
+    Money amount;
+    bool applied;
+} BatchTransferItem;
+
 // Structure for Database
 typedef struct {
     int userid;
     int totalUsers;
     UserAccount *userAccountArr;
-    Transaction *transaction_history;
-    Coins exchange_rates;
+    int *usernameIndex;     // Open-addressing hash of username -> user slot + 1
+    int usernameIndexSize;
+    RateSet *rates;         // Current rates, read through acquireRates
+    unsigned rate_parity;   // Counter half new rate readers register in
+    pthread_mutex_t rate_update_lock;   // Serializes rate publications
+    RateReaderSlot rate_readers[RATE_READER_SLOTS];
+    SlabAllocator transaction_slab; // Owns every Transaction in the users' histories
+    long wal_sequence;      // Sequence number of the last logged/replayed mutation
+    pthread_rwlock_t lock;  // Shared by request steps, exclusive for table reshapes
+    pthread_rwlock_t history_lock;  // Guards the transaction slab and history arrays
+    LockStripe account_locks[ACCOUNT_LOCK_STRIPES]; // Balances, hashed by account
 } ServerDatabase;
 
+// Mutation kinds recorded in the write-ahead log
+typedef enum {
+    WAL_CREATE_USER = 1,
+    WAL_DEPOSIT,
+    WAL_WITHDRAW,
+    WAL_EXCHANGE,
+    WAL_CREATE_ACCOUNT,
+    WAL_DELETE_ACCOUNT,
+    WAL_SET_RATES,          // New Coins stored in the username field
+    WAL_TRANSFER            // Recipient stored in the username field as a WalTransferTarget
+} WalRecordType;
+
+// Fixed-size write-ahead log record (laid out without padding so the
+// checksum covers every byte that reaches the disk)
+typedef struct {
+    long sequence;
+    int type;
+    int client_id;
+    int account_id;
+    int currency_from;
+    int currency_to;
+    int is_shared;
+    Money amount_from;
+    Money amount_to;
+    char username[CREDENTIAL_SIZE];
+    char password[CREDENTIAL_SIZE];
+    int format;
+    unsigned int checksum;
+} WalRecord;
+
+// Recipient of a logged transfer. A batch transfer is logged as consecutive
+// records, each counting the records of its batch that still follow it.
+typedef struct {
+    int client_id;
+    int account_id;
+    int batch_remaining;
+} WalTransferTarget;
+
+// Request opcodes: guest menu options keep their numbers, logged-in
+// menu options are 10 + their menu number
+typedef enum {
+    OP_LOGIN = 1,
+    OP_REGISTER = 2,
+    OP_QUIT = 3,
+    OP_VIEW_ACCOUNTS = 11,
+    OP_EXCHANGE = 12,
+    OP_WITHDRAW = 13,
+    OP_DEPOSIT = 14,
+    OP_CREATE_ACCOUNT = 15,
+    OP_DELETE_ACCOUNT = 16,
+    OP_TRANSFER = 17,
+    OP_HISTORY = 18,
+    OP_LOGOUT = 19,
+    OP_DELETE_USER = 20,
+    OP_GET_RATES = 21,
+    OP_SET_RATES = 22,      // Admin only: publish a new rate set
+    OP_BATCH_TRANSFER = 23, // Many transfers from one source account
+    OP_CONVERT_BATCH = 24,  // Convert many amounts at the current rates
+    OP_GET_TOTALS = 25      // Admin only: amount of each currency held system-wide
+} Opcode;
+
+// Status carried in every response frame
+typedef enum {
+    STATUS_OK = 0,
+    STATUS_FAILED = 1,          // Understood but refused (funds, credentials, ...)
+    STATUS_BAD_REQUEST = 2,     // Malformed payload or unknown opcode
+    STATUS_NOT_LOGGED_IN = 3,
+    STATUS_UNSUPPORTED = 4,     // Unknown protocol version or unimplemented feature
+    STATUS_FORBIDDEN = 5        // Requires the server's admin user
+} ResponseStatus;
+
+// Decoded frame header; on the wire it is FRAME_HEADER_SIZE big-endian bytes:
+// u8 version, u8 opcode, u16 status, u32 request id, u32 payload length.
+// Responses echo the request id of the frame they answer.
+typedef struct {
+    int version;
+    int opcode;
+    int status;
+    uint32_t request_id;
+    size_t length;
+} FrameHeader;
+
+// Bounded reader/writer over a frame payload; error latches on any overrun
+typedef struct {
+    unsigned char *data;
+    size_t pos;
+    size_t cap;
+    bool error;
+} FrameCursor;
+
+// Encoded payload sizes, used to reserve response space up front
+#define FRAME_ACCOUNT_SIZE (4 + 1 + CURRENCY_COUNT * 8 + 8)
+#define VIEW_ACCOUNTS_MAX ((FRAME_MAX_PAYLOAD - 4) / FRAME_ACCOUNT_SIZE) // Most accounts a user holds; one view reply carries them all
+#define FRAME_TRANSACTION_MAX_SIZE (4 + 4 + 1 + 19 + 1 + 1 + 4 * 8 + 4) // type is at most 19 chars
+
+// Response encoded in place at the end of a session's output buffer
+typedef struct {
+    FrameCursor payload;
+    int opcode;
+} ResponseBuilder;
+
+// Protocol state of a client session
+typedef enum {
+    SESSION_AWAIT_FRAME,
+    SESSION_CLOSED
+} SessionState;
+
+// Heap chunk backing an arena request that outgrew the inline block
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    char data[];
+} ArenaChunk;
+
+// Per-session bump arena for scratch memory that lives for one request
+typedef struct {
+    char block[SESSION_ARENA_SIZE];
+    size_t used;
+    ArenaChunk *overflow;
+} SessionArena;
+
+// Structure for a connected client (one per socket in the event loop)
+typedef struct ClientSession {
+    int client_socket;
+    SessionState state;
+    int input_count;
+    bool isLoggedIn;
+    int logged_in_user_index;
+    char *in_buffer;        // MAX_SIZE bytes, grown while a larger frame arrives
+    size_t in_cap;
+    size_t in_len;
+    uint32_t request_id;    // Echoed on every response to the frame being handled
+    SessionArena arena;     // Reset after every protocol step
+    char *out_buffer;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    unsigned int ready_events;
+    long commit_sequence;   // Replies are held until this WAL record is durable
+    bool parked;
+    struct ClientSession *prev;
+    struct ClientSession *next;
+    struct ClientSession *next_ready;
+    struct ClientSession *next_waiting;
+} ClientSession;
+
 // ==================== CORE FUNCTION DECLARATIONS ====================
 
 // Database Management
 void initializeServerDatabase(ServerDatabase *db);
 void initializeExchangeRates(Coins *rates);
 int saveServerDatabaseToFile(ServerDatabase *db, const char *filename);
+int writeDatabaseSnapshot(ServerDatabase *db, const char *filename);
+int snapshotServerDatabase(ServerDatabase *db);
 int loadServerDatabaseFromFile(ServerDatabase *db, const char *filename);
 void freeServerDatabase(ServerDatabase *db);
 
+// Write-Ahead Log
+long appendWalRecord(ServerDatabase *db, WalRecord *record);
+long appendWalRecords(ServerDatabase *db, WalRecord *records, int count);
+long walAppendedByThread();
+long walDurableSequence();
+bool walCommitFailed();
+int startWalCommitter(int batch_size, int max_delay_ms, int notify_fd);
+void stopWalCommitter();
+void printWalCommitStats();
+int replayWriteAheadLog(ServerDatabase *db, const char *filename);
+int truncateWriteAheadLog();
+int rotateWriteAheadLog();
+void discardRotatedWriteAheadLog();
+void closeWriteAheadLog();
+
 // File Locking
 int lock_database_file();
 int unlock_database_file();
+void lockAccount(ServerDatabase *db, int client_id, int account_id);
+void unlockAccount(ServerDatabase *db, int client_id, int account_id);
+void readAccount(ServerDatabase *db, int client_id, const CurrencyAccount *account, CurrencyAccount *copy);
+void lockAccountPair(ServerDatabase *db, int client_a, int account_a, int client_b, int account_b);
+void unlockAccountPair(ServerDatabase *db, int client_a, int account_a, int client_b, int account_b);
 
 // Currency Operations
 int getCurrencyIndex(const char *currency_name);
 const char* getCurrencyName(int index);
-void applyExchangeRates(Coins *rates, double amount, const char *from_currency, 
-                       double *result, const char *to_currency);
-double getCurrencyBalance(CurrencyAccount *account, int currency_index);
-int updateCurrencyBalance(CurrencyAccount *account, int currency_index, double amount);
-int exchangeCurrency(int client_socket, ServerDatabase *db, UserAccount *user);
+Money currencyScale(int currency_index);
+int toMinorUnits(int currency_index, double amount, Money *result);
+double fromMinorUnits(int currency_index, Money amount);
+void buildExchangeTable(ExchangeTable *table, const Coins *rates);
+void setExchangeRates(ServerDatabase *db, const Coins *rates);
+int validExchangeRates(const Coins *rates);
+int publishExchangeRates(ServerDatabase *db, const Coins *rates);
+int publishExchangeRate(ServerDatabase *db, int currency_index, double rate);
+const RateSet* acquireRates(ServerDatabase *db, RateReadGuard *guard);
+void releaseRates(RateReadGuard *guard);
+int applyExchangeRates(const ExchangeTable *table, Money amount, int from_currency,
+                       Money *result, int to_currency);
+size_t convertCurrencyBatch(const ExchangeTable *table, const uint8_t *from, const uint8_t *to,
+                            const Money *amounts, Money *results, uint8_t *converted, size_t count);
+Money getCurrencyBalance(CurrencyAccount *account, int currency_index);
+int updateCurrencyBalanceAtomic(CurrencyAccount *account, int currency_index, Money amount,
+                                Money *previous);
+int updateCurrencyBalance(CurrencyAccount *account, int currency_index, Money amount,
+                          const ExchangeTable *table);
+void refreshAccountTotal(CurrencyAccount *account, const ExchangeTable *table);
+long revalueAllAccounts(ServerDatabase *db);
+void readCurrencyTotals(Money totals[CURRENCY_COUNT]);
+void rebuildCurrencyTotals(ServerDatabase *db);
+int auditCurrencyTotals(ServerDatabase *db);
+void requestRevaluation();
+int startRevaluationWorker(ServerDatabase *db);
+void stopRevaluationWorker();
+CurrencyAccount* createCurrencyAccount(UserAccount *user, Money initial_deposit, int is_shared);
+int deleteCurrencyAccount(UserAccount *user, int account_index);
+int findCurrencyAccount(UserAccount *user, int account_id);
+int exchangeCurrency(ServerDatabase *db, UserAccount *user, int account_index,
+                     int from_currency, int to_currency, Money amount, Money *exchanged_amount);
+int transferCurrency(ServerDatabase *db, UserAccount *sender, CurrencyAccount *from,
+                     UserAccount *recipient, CurrencyAccount *to, int currency, Money amount);
+int batchTransferCurrency(ServerDatabase *db, UserAccount *sender, CurrencyAccount *from,
+                          BatchTransferItem *items, int count);
 
 // User Management
 int findUserByUsername(ServerDatabase *db, const char *username);
+int findUserByClientId(ServerDatabase *db, int client_id);
+int buildUsernameIndex(ServerDatabase *db, int min_users);
+int indexUsername(ServerDatabase *db, int user_index);
+void unindexUsername(ServerDatabase *db, const char *username);
 int authenticateUser(ServerDatabase *db, const char *username, const char *password);
 int createNewUser(ServerDatabase *db, const char *username, const char *password);
 UserAccount* searchUserByUsername(ServerDatabase* db, const char* username);
 
+// Slab Allocation
+void initializeSlabAllocator(SlabAllocator *slab, size_t slot_size, size_t slots_per_block);
+void* slabAllocate(SlabAllocator *slab);
+void slabRelease(SlabAllocator *slab, void *slot);
+void destroySlabAllocator(SlabAllocator *slab);
+
 // Transaction Management
 void addTransaction(ServerDatabase *db, int client_id, int account_id, 
                    const char *type, const char *from_currency, const char *to_currency,
-                   double amount_from, double amount_to, double exchange_rate);
-void printTransactionHistory(int client_socket, ServerDatabase *db, int client_id);
+                   Money amount_from, Money amount_to, double exchange_rate);
+void addTransferTransactions(ServerDatabase *db, UserAccount *sender, int sender_account_id,
+                             UserAccount *recipient, int recipient_account_id, int currency, Money amount);
+void addBatchTransferTransactions(ServerDatabase *db, UserAccount *sender, int sender_account_id,
+                                  const BatchTransferItem *items, int count);
+int getTransactionHistoryPage(UserAccount *user, long cursor, int limit, int *first);
+void freeTransactionHistory(UserAccount *user);
+void printTransaction(const Transaction *transaction);
+
+// Wire Protocol
+void encodeFrameHeader(unsigned char *out, const FrameHeader *header);
+void decodeFrameHeader(const unsigned char *in, FrameHeader *header);
+void frameCursorInit(FrameCursor *cursor, void *data, size_t cap);
+void framePutU8(FrameCursor *cursor, uint8_t value);
+void framePutU16(FrameCursor *cursor, uint16_t value);
+void framePutU32(FrameCursor *cursor, uint32_t value);
+void framePutI64(FrameCursor *cursor, int64_t value);
+void framePutF64(FrameCursor *cursor, double value);
+void framePutBytes(FrameCursor *cursor, const void *bytes, size_t len);
+uint8_t frameGetU8(FrameCursor *cursor);
+uint16_t frameGetU16(FrameCursor *cursor);
+uint32_t frameGetU32(FrameCursor *cursor);
+int64_t frameGetI64(FrameCursor *cursor);
+double frameGetF64(FrameCursor *cursor);
+void frameGetBytes(FrameCursor *cursor, void *bytes, size_t len);
+void framePutAccount(FrameCursor *cursor, const CurrencyAccount *account);
+void frameGetAccount(FrameCursor *cursor, CurrencyAccount *account);
+void framePutTransaction(FrameCursor *cursor, const Transaction *transaction);
+void frameGetTransaction(FrameCursor *cursor, Transaction *transaction);
+int queueRequest(FrameCursor *batch, int opcode, uint32_t request_id, const void *payload, size_t len);
+int sendFrames(int socket, const void *data, size_t len);
+int sendRequest(int socket, int opcode, uint32_t request_id, const void *payload, size_t len);
+int receiveResponse(int socket, FrameHeader *header, void *payload, size_t cap);
 
 // Client-Server Communication
-void handle_client(int client_socket, int server_socket, ServerDatabase *ServerDatabase);
+void handle_client(ClientSession *session, ServerDatabase *ServerDatabase);
 void initiate_client_operations(int client_socket);
 
+// Client Sessions (event-driven server)
+ClientSession* createClientSession(int client_socket);
+void freeClientSession(ClientSession *session);
+int readClientSession(ClientSession *session);
+int flushClientSession(ClientSession *session);
+unsigned char* sessionReserve(ClientSession *session, size_t len);
+bool beginResponse(ClientSession *session, ResponseBuilder *builder, int opcode, size_t max_payload);
+void finishResponse(ClientSession *session, ResponseBuilder *builder, int status);
+
 // ==================== UTILITY FUNCTION DECLARATIONS ====================
 
 // Signal and Thread Handlers
 void signal_handler(int sig);
 void* server_command_listener(void* arg);
+void* snapshot_worker(void* arg);
 
 // Input/Output Utilities
 void displayMenu(bool loggedIn);
 void clearBuffer(char* buffer);
 void nullTerminate(char* str);
-void tokenizeInput(char *buffer, char ***output);
-void confirmLoginDataTransfer(int socket, char buffer[], size_t bufferSize, int *conf_s);
+int tokenizeInput(char *buffer, SessionArena *arena, char ***output);
 void loginData(char buffer[], size_t bufferSize);
 void checkForInvalidType(void *ptr, bool *check, bool isNum);
 void fixBuffer();
@@ -133,17 +499,18 @@ int bytesRecievedCheck(ssize_t bytes_received);
 // Memory Management
 void memoryAllocationCheck(void *ptr);
 int deepCopyUserAccount(UserAccount* destination, const UserAccount* source);
-void freeTokens(char ***tokens_ptr);
+void* arenaAllocate(SessionArena *arena, size_t size);
+void arenaReset(SessionArena *arena);
 
 // Error Handling
 void socketPerror(int socket);
-void forkPerror(int pid);
 void listenPerror(int socket);
 void dataError(ssize_t bytes_received);
 void unError();
 void filePerror(FILE *file);
 
 // File Operations
+int lock_file_range(int fd, off_t start, off_t len, bool operation);
 int lock_file(int fd, bool operation);
 void initializeCoins(Coins *coins);
 void initializeUserAccount(UserAccount *userAccount);
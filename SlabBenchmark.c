@@ -0,0 +1,139 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <time.h>
+#include <setjmp.h>
+#include "Functions.h"
+
+// Compares Transaction allocation through malloc (one call per record, freed
+// node by node) with the database's slab allocator (bulk release).
+// Each strategy runs in its own child process so RSS figures do not mix.
+//
+// Usage: ./slab_bench [transactions_per_round] [rounds]
+
+#define DEFAULT_TRANSACTIONS 2000000
+#define DEFAULT_ROUNDS 1
+
+typedef enum {
+    BENCH_MALLOC,
+    BENCH_SLAB
+} BenchMode;
+
+static double elapsedSeconds(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Resident set size in kilobytes, read from /proc
+static long residentKilobytes() {
+    FILE *file = fopen("/proc/self/status", "r");
+    if (!file) return -1;
+
+    char line[256];
+    long rss = -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, "VmRSS:", 6) == 0) {
+            rss = strtol(line + 6, NULL, 10);
+            break;
+        }
+    }
+    fclose(file);
+    return rss;
+}
+
+// Fill a record the way addTransaction does
+static void fillTransaction(Transaction *transaction, int id) {
+    transaction->transaction_id = id;
+    transaction->client_id = id % 1000;
+    transaction->account_id = 1;
+    strcpy(transaction->transaction_type, "DEPOSIT");
+    strcpy(transaction->currency_from, "Euro");
+    transaction->currency_to[0] = '\0';
+    transaction->amount_from = id;
+    transaction->amount_to = 0;
+    transaction->exchange_rate = 0;
+    transaction->timestamp = 0;
+}
+
+static void runBenchmark(BenchMode mode, int count, int rounds) {
+    Transaction **records = malloc(count * sizeof(Transaction *));
+    if (records == NULL) {
+        perror("Failed to allocate record table");
+        exit(1);
+    }
+
+    SlabAllocator slab;
+    initializeSlabAllocator(&slab, sizeof(Transaction), TRANSACTION_SLAB_SLOTS);
+
+    double alloc_time = 0, release_time = 0;
+    long peak_rss = 0;
+    for (int round = 0; round < rounds; round++) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < count; i++) {
+            records[i] = mode == BENCH_SLAB ? slabAllocate(&slab) : malloc(sizeof(Transaction));
+            if (records[i] == NULL) {
+                fprintf(stderr, "Allocation failed at record %d\n", i);
+                exit(1);
+            }
+            fillTransaction(records[i], i);
+        }
+        alloc_time += elapsedSeconds(&start);
+
+        long rss = residentKilobytes();
+        if (rss > peak_rss) peak_rss = rss;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (mode == BENCH_SLAB) {
+            destroySlabAllocator(&slab);
+        } else {
+            for (int i = 0; i < count; i++) {
+                free(records[i]);
+            }
+        }
+        release_time += elapsedSeconds(&start);
+    }
+
+    double total = (double)count * rounds;
+    printf("%-7s %14.1f %14.1f %12.2f %12ld %12ld\n",
+           mode == BENCH_SLAB ? "slab" : "malloc",
+           total / alloc_time / 1e6, total / release_time / 1e6,
+           alloc_time * 1e9 / total, peak_rss, residentKilobytes());
+    free(records);
+}
+
+int main(int argc, char *argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_TRANSACTIONS;
+    int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    if (count < 1 || rounds < 1) {
+        fprintf(stderr, "Usage: %s [transactions_per_round] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    printf("Transaction allocation: %d records x %d rounds, %zu bytes each\n",
+           count, rounds, sizeof(Transaction));
+    printf("%-7s %14s %14s %12s %12s %12s\n",
+           "mode", "alloc Mops/s", "release Mops/s", "ns/alloc", "peak RSS kB", "final RSS kB");
+    fflush(stdout);
+
+    BenchMode modes[] = { BENCH_MALLOC, BENCH_SLAB };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork failed");
+            return 1;
+        }
+        if (pid == 0) {
+            runBenchmark(modes[i], count, rounds);
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
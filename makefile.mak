@@ -14,6 +14,8 @@ COMMON_SRC = Functions.c
 # Object files
 SERVER_OBJ = Bank.o Functions.o
 CLIENT_OBJ = Client.o Functions.o
+BENCH_OBJ = SlabBenchmark.o Functions.o
+CONTENTION_OBJ = ContentionBenchmark.o Functions.o
 
 # Header files
 HEADERS = Functions.h
@@ -29,6 +31,19 @@ server: $(SERVER_OBJ)
 client: $(CLIENT_OBJ)
 	$(CC) $(CFLAGS) -o $@ $(CLIENT_OBJ) $(LIBS)
 
+# Transaction allocator benchmark
+slab_bench: $(BENCH_OBJ)
+	$(CC) $(CFLAGS) -o $@ $(BENCH_OBJ) $(LIBS)
+
+# Hot balance contention benchmark (lock-free vs mutex vs fcntl)
+contention_bench: $(CONTENTION_OBJ)
+	$(CC) $(CFLAGS) -o $@ $(CONTENTION_OBJ) $(LIBS)
+
+bench: CFLAGS += -O2
+bench: slab_bench contention_bench
+	./slab_bench
+	./contention_bench
+
 # Object file dependencies
 Bank.o: Bank.c $(HEADERS)
 	$(CC) $(CFLAGS) -c Bank.c
@@ -36,12 +51,18 @@ Bank.o: Bank.c $(HEADERS)
 Client.o: Client.c $(HEADERS)
 	$(CC) $(CFLAGS) -c Client.c
 
+SlabBenchmark.o: SlabBenchmark.c $(HEADERS)
+	$(CC) $(CFLAGS) -c SlabBenchmark.c
+
+ContentionBenchmark.o: ContentionBenchmark.c $(HEADERS)
+	$(CC) $(CFLAGS) -c ContentionBenchmark.c
+
 Functions.o: Functions.c $(HEADERS)
 	$(CC) $(CFLAGS) -c Functions.c
 
 # Clean build artifacts
 clean:
-	rm -f $(TARGETS) *.o database.txt database.lock
+	rm -f $(TARGETS) slab_bench contention_bench *.o database.txt database.lock database.wal database.wal.1
 
 # Clean everything including backup files
 distclean: clean
@@ -121,6 +142,7 @@ help:
 	@echo "distclean - Remove all generated files including backups"
 	@echo "debug     - Build with debug symbols and no optimizations"
 	@echo "release   - Build with optimizations for production"
+	@echo "bench     - Build and run the allocator and balance contention benchmarks"
 	@echo "run       - Build and run server+client automatically"
 	@echo "kill-server - Stop any running server processes"
 	@echo "info      - Show build configuration information"
@@ -131,4 +153,4 @@ help:
 	@echo "help      - Show this help message"
 
 # Phony targets (not actual files)
-.PHONY: all clean distclean install uninstall debug release run kill-server info analyze valgrind-server valgrind-client backup help
\ No newline at end of file
+.PHONY: all clean distclean install uninstall debug release bench run kill-server info analyze valgrind-server valgrind-client backup help
\ No newline at end of file